@@ -3,11 +3,13 @@
 #include <cstring>
 #include <iostream>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "bam.h"
 
 #include "aligned.hpp"
+#include "stats.hpp"
 #include "util.hpp"
 
 
@@ -38,10 +40,10 @@ namespace aligned
     pos_t::pos_t(
             const int col,
             const op_t op,
-            const vector< pair< char, char > > data,
+            vector< pair< char, char > > data,
             const int cov
             ) :
-        vector< pair< char, char > >( data ),
+        vector< pair< char, char > >( std::move( data ) ),
         col( col ),
         cov( cov ),
         op( op )
@@ -109,18 +111,48 @@ namespace aligned
     }
 
     aligned_t::aligned_t( const bam1_t * const bam ) :
-        vector< pos_t >(),
-        tid( bam->core.tid ),
-        qual( bam->core.qual ),
-        flag( bam->core.flag ),
-        mtid( bam->core.mtid ),
-        mpos( bam->core.mpos ),
-        isize( bam->core.isize ),
-        name( string( bam1_qname( bam ) ) ),
-        ncontrib( 0 )
+        vector< pos_t >()
+    {
+        from_bam( bam );
+    }
+
+
+    // the n-th position of read, emptied but with whatever storage it had
+    inline
+    pos_t & reuse_pos( aligned_t & read, unsigned & n, const int col, const op_t op )
+    {
+        if ( n == read.size() )
+            read.emplace_back( col, op );
+        else {
+            pos_t & pos = read[ n ];
+
+            pos.clear();
+            pos.col = col;
+            pos.cov = 1;
+            pos.op = op;
+        }
+
+        return read[ n++ ];
+    }
+
+
+    void aligned_t::from_bam( const bam1_t * const bam )
     {
         int idx = 0, col = bam->core.pos - 1;
         const bool has_quals = bam1_qual( bam )[ 0 ] != 0xFF;
+        unsigned n = 0;
+
+        tid = bam->core.tid;
+        qual = bam->core.qual;
+        flag = bam->core.flag;
+        mtid = bam->core.mtid;
+        mpos = bam->core.mpos;
+        isize = bam->core.isize;
+        name.assign( bam1_qname( bam ) );
+        ncontrib = 0;
+
+        // there are no more positions than bases
+        reserve( bam->core.l_qseq );
 
         for ( int i = 0; i < bam->core.n_cigar; ++i ) {
             const int nop = bam1_cigar( bam )[ i ] >> BAM_CIGAR_SHIFT;
@@ -130,37 +162,38 @@ namespace aligned
                 col += nop;
             }
             else if ( op == BAM_CMATCH || op == BAM_CEQUAL || op == BAM_CDIFF ) {
-                for ( int j = 0; j < nop; ++j, ++idx ) {
-                    pos_t pos( ++col, op_t( op ) );
-
-                    pos.push_back(
-                        make_pair(
-                            bam1_seqi( bam1_seq( bam ), idx ),
-                            has_quals ? bam1_qual( bam )[ idx ] : 0xFF
-                            )
+                for ( int j = 0; j < nop; ++j, ++idx )
+                    reuse_pos( *this, n, ++col, op_t( op ) ).emplace_back(
+                        bam1_seqi( bam1_seq( bam ), idx ),
+                        has_quals ? bam1_qual( bam )[ idx ] : 0xFF
                         );
-
-                    push_back( pos );
-                }
             }
             else if ( op == BAM_CINS ) {
-                pos_t pos( col, op_t( op ) );
+                pos_t & pos = reuse_pos( *this, n, col, op_t( op ) );
+
+                pos.reserve( nop );
 
                 for ( int j = 0; j < nop; ++j, ++idx )
-                    pos.push_back(
-                        make_pair(
-                            bam1_seqi( bam1_seq( bam ), idx ),
-                            has_quals ? bam1_qual( bam )[ idx ] : 0xFF
-                            )
+                    pos.emplace_back(
+                        bam1_seqi( bam1_seq( bam ), idx ),
+                        has_quals ? bam1_qual( bam )[ idx ] : 0xFF
                         );
-
-                push_back( pos );
             }
-            else {
+            else if ( op == BAM_CREF_SKIP ) {
+                col += nop;
+            }
+            // clipped bases are no part of the alignment
+            else if ( op == BAM_CSOFT_CLIP ) {
+                idx += nop;
+            }
+            else if ( op != BAM_CHARD_CLIP && op != BAM_CPAD ) {
                 cerr << "unhandled CIGAR operation encountered" << endl;
                 col += nop;
             }
         }
+
+        // whatever is left over from a longer read
+        erase( begin() + n, end() );
     }
 
 
@@ -185,17 +218,23 @@ namespace aligned
     }
 
 
+    // bam's data buffer is reused, and grown as needed, so bam must come
+    // from bam_init1 or have been through here before
     bool
     aligned_t::to_bam( bam1_t * const bam ) const
     {
         aligned_t::const_iterator it;
         int n_cigar, seq_len, cig_idx, seq_idx, nop;
         op_t op;
+        uint8_t * const data = bam->data;
+        const int m_data = bam->m_data;
 
         if ( !size() )
             return false;
 
         memset( bam, '\0', sizeof( bam1_t ) );
+        bam->data = data;
+        bam->m_data = m_data;
 
         bam->core.pos = ( lpos() < 0 ) ? 0 : lpos();
         bam->core.tid = tid;
@@ -217,7 +256,7 @@ namespace aligned
 
         it = begin();
         n_cigar = 0;
-        seq_len = 0;
+        seq_len = it->size();
         op = it->op;
 
         for ( ++it; it != end(); ++it ) {
@@ -246,12 +285,25 @@ namespace aligned
                 bam->core.l_qseq +
                 bam->l_aux
                 );
-        bam->m_data = bam->data_len;
-        kroundup32( bam->m_data );
-        bam->data = reinterpret_cast< uint8_t * >( calloc( bam->m_data, sizeof( uint8_t ) ) );
 
-        if ( !bam->data )
-            goto error;
+        if ( bam->data_len > bam->m_data ) {
+            uint8_t * grown;
+
+            bam->m_data = bam->data_len;
+            kroundup32( bam->m_data );
+            grown = reinterpret_cast< uint8_t * >( realloc( bam->data, bam->m_data ) );
+
+            if ( !grown ) {
+                bam->m_data = m_data;
+                goto error;
+            }
+
+            bam->data = grown;
+            stats::add( stats::ALLOCATIONS );
+            stats::track( stats::BAM, bam->m_data - m_data );
+        }
+
+        memset( bam->data, '\0', bam->data_len );
 
         memcpy( bam1_qname( bam ), name.c_str(), bam->core.l_qname );
 
@@ -262,6 +314,12 @@ namespace aligned
         nop = 1;
         op = it->op;
 
+        // the loop below starts from the second position
+        for ( vector< pair< char, char > >::const_iterator pit = it->begin(); pit != it->end(); ++pit ) {
+            bam1_seq_seti( bam1_seq( bam ), seq_idx, pit->first );
+            bam1_qual( bam )[ seq_idx++ ] = pit->second;
+        }
+
         for ( ++it; it != end(); ++it ) {
             vector< pair< char, char > >::const_iterator pit;
 
@@ -302,20 +360,23 @@ namespace aligned
         return true;
 
 error:
+        stats::track( stats::BAM, -bam->m_data );
         free( bam->data );
         memset( bam, '\0', sizeof( bam1_t ) );
 
         return false;
     }
 
-    vector< pos_t > aligned_t::to_vector() const
+    vector< pos_t > aligned_t::to_vector() const &
+    {
+        return vector< pos_t >( begin(), end() );
+    }
+
+    vector< pos_t > aligned_t::to_vector() &&
     {
-        aligned_t::const_iterator it;
         vector< pos_t > vec;
 
-        for ( it = begin(); it != end(); ++it ) {
-            vec.push_back( *it );
-        }
+        vec.swap( *this );
 
         return vec;
     }
@@ -67,8 +67,13 @@ namespace aligned
         int lpos() const;
         int rpos() const;
 
+        // become bam, reusing our positions' storage, so that one aligned_t
+        // kept across reads doesn't allocate in the steady state
+        void from_bam( const bam1_t * const bam );
         bool to_bam( bam1_t * const bam ) const;
-        std::vector< pos_t > to_vector() const;
+        std::vector< pos_t > to_vector() const &;
+        // a temporary gives up its positions rather than copy them
+        std::vector< pos_t > to_vector() &&;
     };
 }
 
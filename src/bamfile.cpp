@@ -1,14 +1,25 @@
 
+#include <algorithm>
+#include <climits>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <string>
 #include <vector>
 
 #include "aligned.hpp"
 #include "bamfile.hpp"
+#include "stats.hpp"
 
 
 using std::cerr;
+using std::deque;
 using std::endl;
+using std::sort;
+using std::upper_bound;
+using std::string;
 using std::vector;
 
 using aligned::aligned_t;
@@ -20,9 +31,31 @@ using aligned::aligned_t;
 
 namespace bamfile
 {
+    region_t::region_t( const int tid, const int begin, const int end ) :
+        tid( tid ),
+        begin( begin ),
+        end( end )
+    {
+    }
+
+
+    bool region_cmp( const region_t & x, const region_t & y )
+    {
+        if ( x.tid != y.tid )
+            return x.tid < y.tid;
+        return x.begin < y.begin;
+    }
+
+
     bamfile_t::bamfile_t( const char * path, bam_mode_t mode, bool index ) :
         fp( NULL ),
         idx( NULL ),
+        iter( NULL ),
+        path( path ),
+        region( 0 ),
+        cache_tid( -1 ),
+        cache_begin( 0 ),
+        cache_end( 0 ),
         hdr( NULL )
     {
         if ( strcmp( path, "-" ) ) {
@@ -46,6 +79,8 @@ namespace bamfile
 
     bamfile_t::~bamfile_t()
     {
+        if ( iter != NULL )
+            bam_iter_destroy( iter );
         if ( hdr != NULL )
             bam_header_destroy( hdr );
         if ( idx != NULL )
@@ -66,7 +101,32 @@ namespace bamfile
     {
         fetch_t * data = reinterpret_cast< fetch_t * >( tmp );
         
-        data->reads.push_back( aligned_t( bam ) );
+        data->reads.emplace_back( bam );
+
+        stats::add( stats::READS );
+        stats::add( stats::BYTES_DECODED, bam->data_len );
+
+        return 0;
+    }
+
+
+    typedef struct {
+        // reads starting before skip are cached already
+        int skip;
+        deque< aligned_t > & reads;
+    } window_t;
+
+
+    static int window_func( const bam1_t * const bam, void * tmp )
+    {
+        window_t * data = reinterpret_cast< window_t * >( tmp );
+
+        if ( bam->core.pos >= data->skip ) {
+            data->reads.emplace_back( bam );
+
+            stats::add( stats::READS );
+            stats::add( stats::BYTES_DECODED, bam->data_len );
+        }
 
         return 0;
     }
@@ -76,7 +136,7 @@ namespace bamfile
     {
         fetch_t data = { begin, end, reads };
 
-        if ( !idx ) {
+        if ( !load_index() ) {
             cerr << "BAM index not found" << endl;
             exit( 1 );
         }
@@ -85,13 +145,82 @@ namespace bamfile
     }
 
 
+    // as fetch, but for windows sliding along tid: the reads still overlapping
+    // [ begin, end ) are kept from the previous call, so only the reads entering
+    // the window are fetched and decoded, and every read is decoded just once
+    // as long as begin and end never decrease; reads are kept in order of position
+    // and evicted from the front, so a short read behind a long one may outstay
+    // the window a little: check the overlap of what you get
+    const deque< aligned_t > & bamfile_t::fetch_window( const int begin, const int end, const int tid )
+    {
+        if ( !load_index() ) {
+            cerr << "BAM index not found" << endl;
+            exit( 1 );
+        }
+
+        // start over if the window jumped backwards, or past the cache
+        if ( tid != cache_tid || begin < cache_begin || end < cache_end || begin >= cache_end ) {
+            window_t data = { INT_MIN, cache };
+
+            cache.clear();
+            cache_tid = tid;
+            bam_fetch( fp, idx, tid, begin, end, reinterpret_cast< void * >( &data ), window_func );
+        }
+        else {
+            while ( !cache.empty() && cache.front().rpos() < begin )
+                cache.pop_front();
+
+            // the reads overlapping [ cache_end, end ) which start before cache_end
+            // overlapped the previous window too, so we have them already
+            if ( end > cache_end ) {
+                window_t data = { cache_end, cache };
+                bam_fetch( fp, idx, tid, cache_end, end, reinterpret_cast< void * >( &data ), window_func );
+            }
+        }
+
+        cache_begin = begin;
+        cache_end = end;
+
+        return cache;
+    }
+
+
     bool bamfile_t::next( bam1_t * const bam )
     {
         if ( fp->is_write )
             return false;
 
-        if ( bam_read1( fp, bam ) >= 0 )
-            return true;
+        if ( regions.empty() ) {
+            if ( bam_read1( fp, bam ) >= 0 ) {
+                stats::add( stats::READS );
+                stats::add( stats::BYTES_DECODED, bam->data_len );
+                return true;
+            }
+
+            return false;
+        }
+
+        while ( region < regions.size() ) {
+            if ( !iter )
+                iter = bam_iter_query( idx, regions[ region ].tid, regions[ region ].begin, regions[ region ].end );
+
+            if ( bam_iter_read( fp, iter, bam ) >= 0 ) {
+                // reads starting within the previous region were already returned
+                if ( region > 0 &&
+                        regions[ region - 1 ].tid == bam->core.tid &&
+                        bam->core.pos < regions[ region - 1 ].end )
+                    continue;
+
+                stats::add( stats::READS );
+                stats::add( stats::BYTES_DECODED, bam->data_len );
+
+                return true;
+            }
+
+            bam_iter_destroy( iter );
+            iter = NULL;
+            ++region;
+        }
 
         return false;
     }
@@ -110,6 +239,14 @@ namespace bamfile
 
     bool bamfile_t::seek0()
     {
+        if ( !regions.empty() ) {
+            if ( iter != NULL )
+                bam_iter_destroy( iter );
+            iter = NULL;
+            region = 0;
+            return true;
+        }
+
         return bam_seek( fp, zero, SEEK_SET ) == 0;
     }
 
@@ -123,6 +260,132 @@ namespace bamfile
 
         bam_write1( fp, bam );
 
+        stats::add( stats::RECORDS_WRITTEN );
+
         return true;
     }
+
+
+    bool bamfile_t::load_index()
+    {
+        if ( !idx && path != "-" )
+            idx = bam_index_load( path.c_str() );
+
+        return idx != NULL;
+    }
+
+
+    // sort regions and merge those which overlap or abut, leaving them disjoint;
+    // call this once after adding regions, not once per region
+    void bamfile_t::coalesce_regions()
+    {
+        vector< region_t > merged;
+        vector< region_t >::const_iterator it;
+
+        sort( regions.begin(), regions.end(), region_cmp );
+
+        for ( it = regions.begin(); it != regions.end(); ++it ) {
+            if ( !merged.empty() && merged.back().tid == it->tid && it->begin <= merged.back().end ) {
+                if ( it->end > merged.back().end )
+                    merged.back().end = it->end;
+            }
+            else
+                merged.push_back( *it );
+        }
+
+        regions = merged;
+    }
+
+
+    // restrict next() to the reads overlapping str, as chr:begin-end (1-based, inclusive)
+    bool bamfile_t::add_region( const char * str )
+    {
+        int tid, begin, end;
+
+        if ( fp->is_write || !load_index() ) {
+            cerr << "BAM index not found" << endl;
+            return false;
+        }
+
+        if ( bam_parse_region( hdr, str, &tid, &begin, &end ) < 0 || tid < 0 )
+            return false;
+
+        regions.push_back( region_t( tid, begin, end ) );
+        coalesce_regions();
+
+        return true;
+    }
+
+
+    // restrict next() to the reads overlapping any region of a BED file
+    bool bamfile_t::add_bed( const char * bed )
+    {
+        FILE * file;
+        char line[ 4096 ];
+
+        if ( fp->is_write || !load_index() ) {
+            cerr << "BAM index not found" << endl;
+            return false;
+        }
+
+        file = fopen( bed, "r" );
+
+        if ( !file )
+            return false;
+
+        while ( fgets( line, sizeof( line ), file ) ) {
+            char chrom[ 4096 ];
+            int begin, end, tid;
+
+            if ( line[ 0 ] == '#' || !strncmp( line, "track", 5 ) || !strncmp( line, "browser", 7 ) )
+                continue;
+
+            if ( sscanf( line, "%4095s %d %d", chrom, &begin, &end ) != 3 )
+                continue;
+
+            tid = bam_get_tid( hdr, chrom );
+
+            if ( tid < 0 || begin < 0 || end <= begin )
+                goto error;
+
+            regions.push_back( region_t( tid, begin, end ) );
+        }
+
+        fclose( file );
+        coalesce_regions();
+
+        return true;
+
+    error:
+        fclose( file );
+        coalesce_regions();
+
+        return false;
+    }
+
+
+    const vector< region_t > & bamfile_t::get_regions() const
+    {
+        return regions;
+    }
+
+
+    // does column col of reference tid fall within our regions (or are there none)?
+    bool bamfile_t::in_regions( const int tid, const int col ) const
+    {
+        vector< region_t >::const_iterator it;
+
+        if ( regions.empty() )
+            return true;
+
+        // regions are sorted and disjoint, so only the last one beginning at or before col can contain it
+        it = upper_bound( regions.begin(), regions.end(), region_t( tid, col, col ), region_cmp );
+
+        if ( it == regions.begin() )
+            return false;
+
+        --it;
+
+        return it->tid == tid && col < it->end;
+    }
 }
@@ -1,4 +1,6 @@
 
+#include <deque>
+#include <string>
 #include <vector>
 
 #include "bam.h"
@@ -12,12 +14,34 @@ namespace bamfile
 {
     enum bam_mode_t { READ, WRITE };
 
+    // a half-open, 0-based interval [ begin, end ) on reference tid
+    class region_t
+    {
+    public:
+        int tid;
+        int begin;
+        int end;
+
+        region_t( const int tid, const int begin, const int end );
+    };
+
     class bamfile_t
     {
     private:
         bamFile fp;
         bam_index_t * idx;
+        bam_iter_t iter;
         long zero;
+        std::string path;
+        std::vector< region_t > regions;
+        unsigned region;
+        std::deque< aligned::aligned_t > cache;
+        int cache_tid;
+        int cache_begin;
+        int cache_end;
+
+        bool load_index();
+        void coalesce_regions();
 
     public:
         bam_header_t * hdr;
@@ -31,9 +55,19 @@ namespace bamfile
                 const int end,
                 const int tid = 0
                 );
+        const std::deque< aligned::aligned_t > & fetch_window(
+                const int begin,
+                const int end,
+                const int tid = 0
+                );
         bool seek0();
         bool write_header( const bam_header_t * hdr_ = NULL );
         bool write( const bam1_t * const aln );
+
+        bool add_region( const char * str );
+        bool add_bed( const char * bed );
+        const std::vector< region_t > & get_regions() const;
+        bool in_regions( const int tid, const int col ) const;
     };
 }
 
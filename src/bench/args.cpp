@@ -0,0 +1,153 @@
+
+/* argument parsing ------------------------------------------------------------------------------------------------- */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "args.hpp"
+
+
+// some crazy shit for stringifying preprocessor directives
+#define STRIFY(x) #x
+#define TO_STR(x) STRIFY(x)
+
+const char usage[] =
+    "usage: " EXEC " [-h] "
+    "[-d DEPTH] "
+    "[-l LENGTH] "
+    "[-n READ_LENGTH] "
+    "[-e ERROR_RATE] "
+    "[-r REPEATS] "
+    "[-s SEED] "
+    "[-f FILTER]\n";
+
+const char help_msg[] =
+    "time the hot paths of merger, puncher and variants on synthetic reads\n"
+    "\n"
+    "optional arguments:\n"
+    "  -h, --help               show this help message and exit\n"
+    "  -d DEPTH                 mean depth of the synthetic reads (default="
+                                TO_STR( DEFAULT_DEPTH ) ")\n"
+    "  -l LENGTH                length of the synthetic reference (default="
+                                TO_STR( DEFAULT_LENGTH ) ")\n"
+    "  -n READ_LENGTH           length of the synthetic reads (default="
+                                TO_STR( DEFAULT_READ_LENGTH ) ")\n"
+    "  -e ERROR_RATE            per-base substitution rate of the reads (default="
+                                TO_STR( DEFAULT_ERROR_RATE ) ")\n"
+    "  -r REPEATS               time every benchmark REPEATS times, keeping the best (default="
+                                TO_STR( DEFAULT_REPEATS ) ")\n"
+    "  -s SEED                  random seed (default="
+                                TO_STR( DEFAULT_SEED ) ")\n"
+    "  -f FILTER                only run the benchmarks whose name contains FILTER\n";
+
+inline
+void help()
+{
+    fprintf( stderr, "%s\n%s", usage, help_msg );
+    exit( 1 );
+}
+
+#define ERROR( msg, args... ) \
+{ \
+    fprintf( stderr, "%s" EXEC ": error: " msg "\n", usage , ##args ); \
+    exit( 1 ); \
+}
+
+// args_t ----------------------------------------------------------------------------------------------------------- //
+
+args_t::args_t( int argc, const char * argv[] ) :
+    depth( DEFAULT_DEPTH ),
+    length( DEFAULT_LENGTH ),
+    read_length( DEFAULT_READ_LENGTH ),
+    error_rate( DEFAULT_ERROR_RATE ),
+    repeats( DEFAULT_REPEATS ),
+    seed( DEFAULT_SEED ),
+    filter( NULL )
+{
+    int i;
+
+    // skip arg[0], it's just the program name
+    for ( i = 1; i < argc; ++i ) {
+        const char * arg = argv[i];
+
+        if ( arg[0] == '-' && arg[1] == '-' ) {
+            if ( !strcmp( &arg[2], "help" ) ) help();
+            else
+                ERROR( "unknown argument: %s", arg );
+        }
+        else if ( arg[0] == '-' ) {
+            if ( !strcmp( &arg[1], "h" ) ) help();
+            else if ( !strcmp( &arg[1], "d" ) ) parse_depth( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "l" ) ) parse_length( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "n" ) ) parse_readlength( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "e" ) ) parse_errorrate( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "r" ) ) parse_repeats( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "s" ) ) parse_seed( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "f" ) ) parse_filter( argv[ ++i ] );
+            else
+                ERROR( "unknown argument: %s", arg );
+        }
+        else
+            ERROR( "unknown argument: %s", arg );
+    }
+
+    if ( read_length > length )
+        ERROR( "read length must not exceed the reference length" );
+}
+
+void args_t::parse_depth( const char * str )
+{
+    depth = str ? atoi( str ) : 0;
+
+    if ( depth < 1 )
+        ERROR( "depth must be an integer greater than 0, had: %s", str ? str : "" );
+}
+
+void args_t::parse_length( const char * str )
+{
+    length = str ? atoi( str ) : 0;
+
+    if ( length < 1 )
+        ERROR( "length must be an integer greater than 0, had: %s", str ? str : "" );
+}
+
+void args_t::parse_readlength( const char * str )
+{
+    read_length = str ? atoi( str ) : 0;
+
+    if ( read_length < 1 )
+        ERROR( "read length must be an integer greater than 0, had: %s", str ? str : "" );
+}
+
+void args_t::parse_errorrate( const char * str )
+{
+    error_rate = str ? atof( str ) : -1.0;
+
+    if ( error_rate < 0.0 || error_rate >= 1.0 )
+        ERROR( "error rate must be a real number in [0.0, 1.0), had: %s", str ? str : "" );
+}
+
+void args_t::parse_repeats( const char * str )
+{
+    repeats = str ? atoi( str ) : 0;
+
+    if ( repeats < 1 )
+        ERROR( "repeats must be an integer greater than 0, had: %s", str ? str : "" );
+}
+
+void args_t::parse_seed( const char * str )
+{
+    if ( !str )
+        ERROR( "missing argument to -s" );
+
+    seed = strtoul( str, NULL, 10 );
+}
+
+void args_t::parse_filter( const char * str )
+{
+    if ( !str )
+        ERROR( "missing argument to -f" );
+
+    filter = str;
+}
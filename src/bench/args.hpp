@@ -0,0 +1,38 @@
+
+#ifndef ARGPARSE_H
+#define ARGPARSE_H
+
+// program name
+#define EXEC "bench"
+
+// argument defaults
+#define DEFAULT_DEPTH 200
+#define DEFAULT_LENGTH 2000
+#define DEFAULT_READ_LENGTH 150
+#define DEFAULT_ERROR_RATE 0.005
+#define DEFAULT_REPEATS 3
+#define DEFAULT_SEED 42
+
+class args_t
+{
+public:
+    int depth;
+    int length;
+    int read_length;
+    double error_rate;
+    int repeats;
+    unsigned seed;
+    const char * filter;
+
+    args_t( int, const char ** );
+private:
+    void parse_depth( const char * );
+    void parse_length( const char * );
+    void parse_readlength( const char * );
+    void parse_errorrate( const char * );
+    void parse_repeats( const char * );
+    void parse_seed( const char * );
+    void parse_filter( const char * );
+};
+
+#endif // ARGPARSE_H
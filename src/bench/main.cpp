@@ -0,0 +1,403 @@
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "bam.h"
+
+#include "aligned.hpp"
+#include "args.hpp"
+#include "bamfile.hpp"
+#include "coverage.hpp"
+#include "math.hpp"
+#include "merge.hpp"
+#include "progress.hpp"
+#include "rateclass.hpp"
+
+
+using std::cerr;
+using std::endl;
+using std::list;
+using std::make_pair;
+using std::map;
+using std::pair;
+using std::sort;
+using std::vector;
+
+using aligned::MATCH;
+using aligned::aligned_t;
+using aligned::pos_t;
+using bamfile::READ;
+using bamfile::WRITE;
+using bamfile::bamfile_t;
+using coverage::cov_t;
+using coverage::coverage_t;
+using coverage::elem_t;
+using math::lg_factorial_reserve;
+using math::lg_prob_background;
+using merge::cluster_t;
+using merge::merge_clusters;
+using merge::merge_reads;
+using rateclass::rateclass_t;
+
+
+// number of clusters handed to merge_clusters at a time
+#define BENCH_CLUSTERS 512
+
+
+inline
+double now()
+{
+    struct timeval tv;
+
+    gettimeofday( &tv, NULL );
+
+    return tv.tv_sec + 1e-6 * tv.tv_usec;
+}
+
+
+// the synthetic data every benchmark draws on
+class fixture_t
+{
+public:
+    const char * path;
+    vector< aligned_t > reads;
+    vector< bam1_t * > bams;
+    vector< cluster_t > clusters;
+    vector< pair< int, int > > data;
+    int max_cov;
+
+    fixture_t( const args_t & args, const char * path );
+    ~fixture_t();
+};
+
+
+// a random reference, and reads drawn uniformly from it with substitution errors,
+// sorted by position and written out to a BAM at path
+fixture_t::fixture_t( const args_t & args, const char * path ) :
+    path( path ),
+    max_cov( 0 )
+{
+    const char nucs[] = { 1, 2, 4, 8 };
+    const int nread = int( ( double( args.depth ) * args.length ) / args.read_length + 0.5 );
+    vector< int > ref( args.length );
+    vector< int > lpos( nread );
+    coverage_t coverage;
+    coverage_t::const_iterator cit;
+
+    srand( args.seed );
+
+    for ( int i = 0; i < args.length; ++i )
+        ref[ i ] = rand() % 4;
+
+    for ( int i = 0; i < nread; ++i )
+        lpos[ i ] = rand() % ( args.length - args.read_length + 1 );
+
+    sort( lpos.begin(), lpos.end() );
+
+    for ( int i = 0; i < nread; ++i ) {
+        aligned_t read;
+        char name[ 32 ];
+
+        snprintf( name, 32, "read%d", i );
+        read.name = name;
+
+        for ( int j = 0; j < args.read_length; ++j ) {
+            pos_t pos( lpos[ i ] + j, MATCH );
+            int nuc = ref[ lpos[ i ] + j ];
+
+            // substitute any of the other three
+            if ( rand() < args.error_rate * RAND_MAX )
+                nuc = ( nuc + 1 + rand() % 3 ) % 4;
+
+            pos.push_back( make_pair( nucs[ nuc ], char( 30 ) ) );
+            read.push_back( pos );
+        }
+
+        reads.push_back( read );
+    }
+
+    {
+        bamfile_t out( path, WRITE );
+
+        out.hdr->n_targets = 1;
+        out.hdr->target_name = reinterpret_cast< char ** >( malloc( sizeof( char * ) ) );
+        out.hdr->target_name[ 0 ] = strdup( "synthetic" );
+        out.hdr->target_len = reinterpret_cast< uint32_t * >( malloc( sizeof( uint32_t ) ) );
+        out.hdr->target_len[ 0 ] = args.length;
+
+        out.write_header();
+
+        for ( int i = 0; i < nread; ++i ) {
+            bam1_t * const bam = bam_init1();
+
+            if ( !reads[ i ].to_bam( bam ) ) {
+                cerr << "error converting to BAM format" << endl;
+                exit( 1 );
+            }
+
+            bam->core.bin = bam_reg2bin( bam->core.pos, bam_calend( &bam->core, bam1_cigar( bam ) ) );
+            bams.push_back( bam );
+            out.write( bam );
+        }
+    }
+
+    for ( int i = 0; i < nread; ++i ) {
+        clusters.push_back( cluster_t( reads[ i ] ) );
+        coverage.include( reads[ i ] );
+    }
+
+    // ( coverage, majority ) data, as variants collects it
+    for ( cit = coverage.begin(); cit != coverage.end(); ++cit ) {
+        map< elem_t, int >::const_iterator it;
+        int cov = 0, max = 0;
+
+        if ( cit->op != MATCH )
+            continue;
+
+        for ( it = cit->obs.begin(); it != cit->obs.end(); ++it ) {
+            cov += it->second;
+            if ( it->second > max )
+                max = it->second;
+        }
+
+        if ( cov > max_cov )
+            max_cov = cov;
+
+        for ( it = cit->obs.begin(); it != cit->obs.end(); ++it )
+            if ( it->second != max )
+                data.push_back( make_pair( cov, cov - it->second ) );
+    }
+}
+
+
+fixture_t::~fixture_t()
+{
+    for ( unsigned i = 0; i < bams.size(); ++i )
+        bam_destroy1( bams[ i ] );
+
+    unlink( path );
+}
+
+// micro-benchmarks ------------------------------------------------------------------------------------------------- //
+
+// every benchmark returns the number of operations it timed,
+// and writes what it computes to sink so that none of it is optimized away
+volatile long sink;
+
+static long decode( const fixture_t & fix )
+{
+    for ( unsigned i = 0; i < fix.bams.size(); ++i ) {
+        aligned_t read( fix.bams[ i ] );
+        sink = read.size();
+    }
+
+    return fix.bams.size();
+}
+
+
+static long encode( const fixture_t & fix )
+{
+    bam1_t * const bam = bam_init1();
+
+    for ( unsigned i = 0; i < fix.reads.size(); ++i )
+        sink = fix.reads[ i ].to_bam( bam );
+
+    bam_destroy1( bam );
+
+    return fix.reads.size();
+}
+
+
+static long include( const fixture_t & fix )
+{
+    coverage_t coverage;
+
+    for ( unsigned i = 0; i < fix.reads.size(); ++i )
+        coverage.include( fix.reads[ i ] );
+
+    sink = coverage.size();
+
+    return fix.reads.size();
+}
+
+
+static long cluster_merge( const fixture_t & fix )
+{
+    // neighbouring reads overlap, as they're sorted by position
+    for ( unsigned i = 1; i < fix.clusters.size(); ++i )
+        sink = fix.clusters[ i - 1 ].merge( fix.clusters[ i ], 0, true, true ).size();
+
+    return fix.clusters.size() - 1;
+}
+
+
+static long merge_cluster_batch( const fixture_t & fix )
+{
+    const unsigned n = ( fix.clusters.size() < BENCH_CLUSTERS ) ? fix.clusters.size() : BENCH_CLUSTERS;
+    vector< cluster_t > clusters( fix.clusters.begin(), fix.clusters.begin() + n );
+
+    merge_clusters( n, 0, true, true, clusters, false );
+
+    sink = clusters.size();
+
+    return 1;
+}
+
+
+static long fit( const fixture_t & fix )
+{
+    rateclass_t rc( fix.data, 3 );
+    vector< pair< double, double > > params;
+    double lg_L, aicc;
+
+    rc( lg_L, aicc, params );
+
+    sink = params.size();
+
+    return 1;
+}
+
+
+static long prob_background( const fixture_t & fix )
+{
+    const double lg_bg = log( 0.005 ), lg_invbg = log( 0.995 );
+    double lg_prob = 0.0;
+
+    for ( unsigned i = 0; i < fix.data.size(); ++i )
+        lg_prob += lg_prob_background( lg_bg, lg_invbg, fix.data[ i ].first, fix.data[ i ].first - fix.data[ i ].second );
+
+    sink = long( lg_prob );
+
+    return fix.data.size();
+}
+
+// end-to-end ------------------------------------------------------------------------------------------------------- //
+
+static long read_bam( const fixture_t & fix )
+{
+    bamfile_t in( fix.path, READ );
+    bam1_t * const bam = bam_init1();
+    long nread = 0;
+
+    for ( ; in.next( bam ); ++nread ) {
+        aligned_t read( bam );
+        sink = read.size();
+    }
+
+    bam_destroy1( bam );
+
+    return nread;
+}
+
+
+static long pileup_bam( const fixture_t & fix )
+{
+    bamfile_t in( fix.path, READ );
+    bam1_t * const bam = bam_init1();
+    coverage_t coverage;
+    list< cov_t > done;
+    long nread = 0;
+
+    // as variants streams its input
+    for ( ; in.next( bam ); ++nread ) {
+        aligned_t read( bam );
+
+        coverage.release( bam->core.pos - 1, done );
+        done.clear();
+        coverage.include( read );
+    }
+
+    coverage.release( INT_MAX, done );
+    sink = done.size();
+
+    bam_destroy1( bam );
+
+    return nread;
+}
+
+
+static long merge_bam( const fixture_t & fix )
+{
+    bamfile_t in( fix.path, READ );
+
+    sink = merge_reads( in, 0, true, true ).size();
+
+    return fix.reads.size();
+}
+
+
+// time func on fix, keeping the best of args.repeats runs
+void run( const args_t & args, const char * name, long ( * const func )( const fixture_t & ), const fixture_t & fix )
+{
+    double best = HUGE_VAL;
+    long nop = 0;
+
+    if ( args.filter && !strstr( name, args.filter ) )
+        return;
+
+    for ( int i = 0; i < args.repeats; ++i ) {
+        const double begin = now();
+
+        nop = func( fix );
+
+        const double elapsed = now() - begin;
+
+        if ( elapsed < best )
+            best = elapsed;
+    }
+
+    fprintf( stdout, "%s\t%ld\t%.3f\t%.1f\n", name, nop, 1e3 * best, nop ? 1e9 * best / nop : 0.0 );
+    fflush( stdout );
+}
+
+
+int main( int argc, const char * argv[] )
+{
+    args_t args = args_t( argc, argv );
+    char path[] = "/tmp/benchXXXXXX";
+    const int fd = mkstemp( path );
+
+    if ( fd < 0 ) {
+        cerr << "unable to create a temporary file" << endl;
+        return -1;
+    }
+
+    close( fd );
+
+    fixture_t fix( args, path );
+
+    lg_factorial_reserve( fix.max_cov );
+
+    // keep e2e:merge_reads from reporting on the benchmarks' stderr
+    progress::disable();
+
+    fprintf( stdout, "# depth=%d length=%d read_length=%d error_rate=%g reads=%lu\n",
+        args.depth, args.length, args.read_length, args.error_rate, fix.reads.size() );
+    fprintf( stdout, "benchmark\tops\tbest_ms\tns_per_op\n" );
+
+    run( args, "aligned_t(bam1_t*)", decode, fix );
+    run( args, "aligned_t::to_bam", encode, fix );
+    run( args, "coverage_t::include", include, fix );
+    run( args, "cluster_t::merge", cluster_merge, fix );
+    run( args, "merge_clusters", merge_cluster_batch, fix );
+    run( args, "rateclass_t", fit, fix );
+    run( args, "lg_prob_background", prob_background, fix );
+
+    run( args, "e2e:read", read_bam, fix );
+    run( args, "e2e:pileup", pileup_bam, fix );
+    run( args, "e2e:merge_reads", merge_bam, fix );
+
+    return 0;
+}
@@ -0,0 +1,200 @@
+
+#include <climits>
+#include <cstdlib>
+#include <iostream>
+#include <list>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "bam.h"
+
+#include "aligned.hpp"
+#include "bamfile.hpp"
+#include "cohort.hpp"
+#include "coverage.hpp"
+
+
+using std::cerr;
+using std::endl;
+using std::list;
+using std::make_pair;
+using std::map;
+using std::vector;
+
+using aligned::op_t;
+using bamfile::bamfile_t;
+using coverage::col_cmp;
+using coverage::cov_t;
+using coverage::elem_t;
+
+
+namespace cohort
+{
+    column_t::column_t( const int tid, const int col, const op_t op ) :
+        tid( tid ),
+        col( col ),
+        op( op )
+    {
+    }
+
+
+    bool column_t::get( const int sample, cov_t & cov ) const
+    {
+        map< elem_t, vector< int > >::const_iterator it;
+
+        cov.col = col;
+        cov.op = op;
+        cov.obs.clear();
+
+        for ( it = obs.begin(); it != obs.end(); ++it )
+            if ( it->second[ sample ] )
+                cov.obs[ it->first ] = it->second[ sample ];
+
+        return !cov.obs.empty();
+    }
+
+
+    cohort_t::cohort_t( const vector< bamfile_t * > & bams ) :
+        bams( bams ),
+        reads( bams.size(), static_cast< bam1_t * >( NULL ) ),
+        coverages( bams.size() ),
+        tid( -1 ),
+        cutoff( -1 )
+    {
+        for ( unsigned i = 0; i < bams.size(); ++i ) {
+            // reads are merged by tid, so the references had better agree
+            if ( bams[ i ]->hdr->n_targets != bams[ 0 ]->hdr->n_targets ) {
+                cerr << "every BAM of a cohort must share the same references" << endl;
+                exit( 1 );
+            }
+
+            reads[ i ] = bam_init1();
+            advance( i );
+        }
+    }
+
+
+    cohort_t::~cohort_t()
+    {
+        for ( unsigned i = 0; i < reads.size(); ++i )
+            bam_destroy1( reads[ i ] );
+    }
+
+
+    int cohort_t::size() const
+    {
+        return bams.size();
+    }
+
+
+    // queue the next read of sample, if it has one; unmapped reads sort last,
+    // so the first one ends the sample
+    void cohort_t::advance( const int sample )
+    {
+        bam1_t * const read = reads[ sample ];
+        const int old_tid = read->core.tid, old_pos = read->core.pos;
+        const bool first = !read->data_len;
+
+        if ( !bams[ sample ]->next( read ) || read->core.tid < 0 )
+            return;
+
+        if ( !first && ( read->core.tid < old_tid || ( read->core.tid == old_tid && read->core.pos < old_pos ) ) ) {
+            cerr << "every BAM of a cohort must be coordinate-sorted" << endl;
+            exit( 1 );
+        }
+
+        heads.push( make_pair( make_pair( unsigned( read->core.tid ), read->core.pos ), sample ) );
+    }
+
+
+    // join the columns left of col of every sample into ready
+    void cohort_t::release( const int col )
+    {
+        vector< list< cov_t > > done( coverages.size() );
+        vector< list< cov_t >::const_iterator > its( coverages.size() );
+        const int nsample = coverages.size();
+
+        for ( int i = 0; i < nsample; ++i ) {
+            coverages[ i ].release( col, done[ i ] );
+            its[ i ] = done[ i ].begin();
+        }
+
+        // k-way merge of the samples' sorted columns
+        for ( ;; ) {
+            const cov_t * min = NULL;
+            map< elem_t, int >::const_iterator it;
+
+            for ( int i = 0; i < nsample; ++i )
+                if ( its[ i ] != done[ i ].end() &&
+                        ( !min || col_cmp( its[ i ]->col, its[ i ]->op, min->col, min->op ) ) )
+                    min = &*its[ i ];
+
+            if ( !min )
+                break;
+
+            column_t column( tid, min->col, min->op );
+
+            for ( int i = 0; i < nsample; ++i ) {
+                if ( its[ i ] == done[ i ].end() || its[ i ]->col != column.col || its[ i ]->op != column.op )
+                    continue;
+
+                for ( it = its[ i ]->obs.begin(); it != its[ i ]->obs.end(); ++it ) {
+                    vector< int > & counts = column.obs[ it->first ];
+
+                    if ( counts.empty() )
+                        counts.resize( nsample, 0 );
+
+                    counts[ i ] = it->second;
+                }
+
+                ++its[ i ];
+            }
+
+            ready.push_back( std::move( column ) );
+        }
+    }
+
+
+    bool cohort_t::next( column_t & column )
+    {
+        while ( ready.empty() ) {
+            if ( heads.empty() ) {
+                if ( tid < 0 )
+                    return false;
+
+                release( INT_MAX );
+                tid = -1;
+                continue;
+            }
+
+            const int sample = heads.top().second;
+            const bam1_t * const read = reads[ sample ];
+
+            heads.pop();
+
+            // every sample is done with the previous reference
+            if ( read->core.tid != tid ) {
+                release( INT_MAX );
+                tid = read->core.tid;
+                cutoff = -1;
+            }
+
+            // insertions at a read's start may land on the column before it
+            if ( read->core.pos - 1 > cutoff ) {
+                cutoff = read->core.pos - 1;
+                release( cutoff );
+            }
+
+            scratch.from_bam( read );
+            coverages[ sample ].include( scratch );
+
+            advance( sample );
+        }
+
+        column = ready.front();
+        ready.pop_front();
+
+        return true;
+    }
+}
@@ -0,0 +1,70 @@
+
+#include <list>
+#include <map>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "bam.h"
+
+#include "aligned.hpp"
+#include "bamfile.hpp"
+#include "coverage.hpp"
+
+
+#ifndef COHORT_H
+#define COHORT_H
+
+namespace cohort
+{
+    // a pileup column across a cohort: for every allele, its count in every sample
+    class column_t
+    {
+    public:
+        int tid;
+        int col;
+        aligned::op_t op;
+        std::map< coverage::elem_t, std::vector< int > > obs;
+
+        column_t( const int tid, const int col, const aligned::op_t op );
+
+        // the column as seen by sample alone; false if the sample has no coverage here
+        bool get( const int sample, coverage::cov_t & cov ) const;
+    };
+
+    // the pileup of several coordinate-sorted BAMs, streamed in lock-step:
+    // the reads of all samples are merged by position, each sample keeps only
+    // the columns its current reads overlap, and a column is handed out,
+    // joined across samples, once no sample's reads can touch it again
+    class cohort_t
+    {
+    private:
+        typedef std::pair< std::pair< unsigned, int >, int > head_t;
+
+        const std::vector< bamfile::bamfile_t * > & bams;
+        std::vector< bam1_t * > reads;
+        std::vector< coverage::coverage_t > coverages;
+        // scratch space reused across reads
+        aligned::aligned_t scratch;
+        std::priority_queue< head_t, std::vector< head_t >, std::greater< head_t > > heads;
+        std::list< column_t > ready;
+        int tid;
+        int cutoff;
+
+        // we own the reads, so no copies
+        cohort_t( const cohort_t & );
+        cohort_t & operator=( const cohort_t & );
+
+        void advance( const int sample );
+        void release( const int col );
+
+    public:
+        cohort_t( const std::vector< bamfile::bamfile_t * > & bams );
+        ~cohort_t();
+
+        int size() const;
+        bool next( column_t & column );
+    };
+}
+
+#endif // COHORT_H
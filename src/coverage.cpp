@@ -1,26 +1,84 @@
 
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
 #include <list>
 #include <map>
+#include <utility>
 #include <vector>
 
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "aligned.hpp"
 #include "coverage.hpp"
+#include "stats.hpp"
 #include "util.hpp"
 
 
+using std::cerr;
+using std::endl;
 using std::list;
 using std::map;
+using std::pair;
 using std::string;
 using std::vector;
 
 using aligned::INS;
+using aligned::MATCH;
 using aligned::aligned_t;
 using aligned::op_t;
 using util::bits2nuc;
 
 
+// the binary pileup format, in host byte order:
+// a header, then ncol columns, nobs observations and nnuc nucleotides,
+// each column pointing at its run of observations,
+// and each observation at its run of nucleotides
+#define PILEUP_MAGIC "MPU1"
+
+
 namespace coverage
 {
+    // what we reckon a column and an observation cost: a list node and
+    // a map node apiece, the latter with its key's buffer of a few bases
+    const long COL_BYTES = sizeof( cov_t ) + 2 * sizeof( void * );
+    const long OBS_BYTES = sizeof( pair< const elem_t, int > ) + 4 * sizeof( void * ) + 16;
+
+
+    inline
+    long col_bytes( const cov_t & cov )
+    {
+        return COL_BYTES + cov.obs.size() * OBS_BYTES;
+    }
+
+
+    typedef struct {
+        char magic[ 4 ];
+        uint32_t reserved;
+        uint64_t ncol;
+        uint64_t nobs;
+        uint64_t nnuc;
+    } header_t;
+
+    typedef struct {
+        int32_t col;
+        int32_t op;
+        uint64_t obs;
+        uint64_t nobs;
+    } column_t;
+
+    typedef struct {
+        uint64_t nuc;
+        uint32_t len;
+        int32_t count;
+    } obs_t;
+
+
     void elem_t::get_seq( string & str ) const
     {
         elem_t::const_iterator it;
@@ -37,29 +95,86 @@ namespace coverage
     {
     }
 
+    coverage_t::coverage_t()
+    {
+    }
+
+
+    coverage_t::coverage_t( const coverage_t & other ) :
+        list< cov_t >( other )
+    {
+        stats::track( stats::COVERAGE, bytes() );
+    }
+
+
+    // other's columns, and what they're tracked at, come over as they are
+    coverage_t::coverage_t( coverage_t && other ) :
+        list< cov_t >( std::move( other ) )
+    {
+    }
+
+
+    coverage_t & coverage_t::operator=( const coverage_t & other )
+    {
+        stats::track( stats::COVERAGE, -bytes() );
+        list< cov_t >::operator=( other );
+        stats::track( stats::COVERAGE, bytes() );
+
+        return *this;
+    }
+
+
+    coverage_t & coverage_t::operator=( coverage_t && other )
+    {
+        stats::track( stats::COVERAGE, -bytes() );
+        list< cov_t >::operator=( std::move( other ) );
+
+        return *this;
+    }
+
+
+    coverage_t::~coverage_t()
+    {
+        stats::track( stats::COVERAGE, -bytes() );
+    }
+
+
+    long coverage_t::bytes() const
+    {
+        const_iterator cit;
+        long n = 0;
+
+        for ( cit = begin(); cit != end(); ++cit )
+            n += col_bytes( *cit );
+
+        return n;
+    }
+
+
     void coverage_t::include( const aligned_t & read )
     {
         iterator cit = begin();
         aligned_t::const_iterator rit = read.begin();
-        for ( ; cit != end() && rit != read.end(); ) {
-            elem_t elem;
+        long nbytes = 0;
 
+        for ( ; cit != end() && rit != read.end(); ) {
             if ( cit->col == rit->col && cit->op == rit->op ) {
                 rit->get_seq( elem );
                 map< elem_t, int >::iterator mit = cit->obs.find( elem );
 
                 if ( mit != cit->obs.end() )
                     ++mit->second;
-                else
-                    cit->obs[ elem ] = 1;
+                else {
+                    // a new key is a copy, sized to fit, so elem keeps its storage
+                    cit->obs.emplace( elem, 1 );
+                    nbytes += OBS_BYTES;
+                }
 
                 // increment iterators here
                 ++rit;
                 ++cit;
             }
             else if ( cit->col == rit->col && rit->op == INS ) {
-                cov_t cov( rit->col, INS );
-                
                 ++cit;
 
                 // we cover this case above
@@ -68,18 +183,16 @@ namespace coverage
 
                 // it's a new insertion, so add it to our coverage
                 rit->get_seq( elem );
-                cov.obs[ elem ] = 1;
-                insert( cit, cov );
+                emplace( cit, rit->col, INS )->obs.emplace( elem, 1 );
+                nbytes += COL_BYTES + OBS_BYTES;
 
                 // cit has already been incremented, but not rit
                 ++rit;
             }
             else if ( rit->col < cit->col ) {
-                cov_t cov( rit->col, rit->op );
-
                 rit->get_seq( elem );
-                cov.obs[ elem ] = 1;
-                insert( cit, cov );
+                emplace( cit, rit->col, rit->op )->obs.emplace( elem, 1 );
+                nbytes += COL_BYTES + OBS_BYTES;
 
                 ++rit;
             }
@@ -91,13 +204,242 @@ namespace coverage
         }
 
         for ( ; rit != read.end(); ++rit ) {
-            elem_t elem;
+            rit->get_seq( elem );
+            emplace( cit, rit->col, rit->op )->obs.emplace( elem, 1 );
+            nbytes += COL_BYTES + OBS_BYTES;
+        }
 
-            cov_t cov( rit->col, rit->op );
+        stats::track( stats::COVERAGE, nbytes );
+    }
 
-            rit->get_seq( elem );
-            cov.obs[ elem ] = 1;
-            insert( cit, cov );
+
+    // move the columns left of col into done; with coordinate-sorted input,
+    // no read starting at or after col can touch them again
+    void coverage_t::release( const int col, list< cov_t > & done )
+    {
+        iterator cit = begin();
+        long nbytes = 0;
+
+        for ( ; cit != end() && cit->col < col; ++cit )
+            nbytes += col_bytes( *cit );
+
+        done.splice( done.end(), *this, begin(), cit );
+
+        // what's done is the caller's to keep or let go
+        stats::track( stats::COVERAGE, -nbytes );
+    }
+
+
+    // add the counts of pileup into our own
+    void coverage_t::merge( const pileup_t & pileup )
+    {
+        iterator cit = begin();
+        cov_t cov( 0, MATCH );
+        long nbytes = 0;
+
+        for ( size_t i = 0; i < pileup.size(); ++i ) {
+            pileup.get( i, cov );
+
+            for ( ; cit != end() && col_cmp( cit->col, cit->op, cov.col, cov.op ); ++cit );
+
+            if ( cit != end() && cit->col == cov.col && cit->op == cov.op ) {
+                map< elem_t, int >::const_iterator it;
+                const long nobs = cit->obs.size();
+
+                for ( it = cov.obs.begin(); it != cov.obs.end(); ++it )
+                    cit->obs[ it->first ] += it->second;
+
+                nbytes += ( long( cit->obs.size() ) - nobs ) * OBS_BYTES;
+            }
+            else {
+                // get() clears cov before refilling it, so it may as well be moved
+                nbytes += col_bytes( cov );
+                insert( cit, std::move( cov ) );
+            }
+        }
+
+        stats::track( stats::COVERAGE, nbytes );
+    }
+
+
+    bool coverage_t::save( const char * path ) const
+    {
+        FILE * const file = fopen( path, "wb" );
+        const_iterator cit;
+        map< elem_t, int >::const_iterator it;
+        header_t header;
+        bool ok = true;
+
+        if ( !file )
+            return false;
+
+        memset( &header, 0, sizeof( header_t ) );
+        memcpy( header.magic, PILEUP_MAGIC, 4 );
+
+        for ( cit = begin(); cit != end(); ++cit ) {
+            ++header.ncol;
+            header.nobs += cit->obs.size();
+            for ( it = cit->obs.begin(); it != cit->obs.end(); ++it )
+                header.nnuc += it->first.size();
+        }
+
+        ok = ok && fwrite( &header, sizeof( header_t ), 1, file ) == 1;
+
+        // the columns
+        {
+            uint64_t nobs = 0;
+
+            for ( cit = begin(); ok && cit != end(); ++cit ) {
+                column_t column;
+
+                memset( &column, 0, sizeof( column_t ) );
+                column.col = cit->col;
+                column.op = cit->op;
+                column.obs = nobs;
+                column.nobs = cit->obs.size();
+                nobs += column.nobs;
+
+                ok = fwrite( &column, sizeof( column_t ), 1, file ) == 1;
+            }
+        }
+
+        // the observations
+        {
+            uint64_t nnuc = 0;
+
+            for ( cit = begin(); ok && cit != end(); ++cit )
+                for ( it = cit->obs.begin(); ok && it != cit->obs.end(); ++it ) {
+                    obs_t obs;
+
+                    memset( &obs, 0, sizeof( obs_t ) );
+                    obs.nuc = nnuc;
+                    obs.len = it->first.size();
+                    obs.count = it->second;
+                    nnuc += obs.len;
+
+                    ok = fwrite( &obs, sizeof( obs_t ), 1, file ) == 1;
+                }
+        }
+
+        // the nucleotides
+        for ( cit = begin(); ok && cit != end(); ++cit )
+            for ( it = cit->obs.begin(); ok && it != cit->obs.end(); ++it )
+                ok = it->first.empty() || fwrite( &it->first[ 0 ], sizeof( char ), it->first.size(), file ) == it->first.size();
+
+        return ( fclose( file ) == 0 ) && ok;
+    }
+
+
+    // does the len bytes at data hold a well-formed pileup? every section must fit
+    // in what's left of the file, and every offset and length land within its
+    // section, as get() trusts them; the sizes are checked by division, as
+    // a corrupt header's counts could overflow a product
+    bool pileup_ok( const char * const data, const size_t len )
+    {
+        const header_t * const header = reinterpret_cast< const header_t * >( data );
+        const column_t * cols;
+        const obs_t * obs;
+        size_t left = len - sizeof( header_t );
+
+        if ( memcmp( header->magic, PILEUP_MAGIC, 4 ) )
+            return false;
+
+        if ( header->ncol > left / sizeof( column_t ) )
+            return false;
+
+        left -= header->ncol * sizeof( column_t );
+
+        if ( header->nobs > left / sizeof( obs_t ) )
+            return false;
+
+        left -= header->nobs * sizeof( obs_t );
+
+        if ( header->nnuc != left )
+            return false;
+
+        cols = reinterpret_cast< const column_t * >( data + sizeof( header_t ) );
+        obs = reinterpret_cast< const obs_t * >( cols + header->ncol );
+
+        for ( uint64_t i = 0; i < header->ncol; ++i )
+            if ( cols[ i ].obs > header->nobs || cols[ i ].nobs > header->nobs - cols[ i ].obs )
+                return false;
+
+        for ( uint64_t i = 0; i < header->nobs; ++i )
+            if ( obs[ i ].nuc > header->nnuc || obs[ i ].len > header->nnuc - obs[ i ].nuc )
+                return false;
+
+        return true;
+    }
+
+
+    pileup_t::pileup_t( const char * path ) :
+        data( MAP_FAILED ),
+        len( 0 ),
+        ncol( 0 ),
+        cols( NULL ),
+        obs( NULL ),
+        nucs( NULL )
+    {
+        const int fd = open( path, O_RDONLY );
+        const header_t * header;
+        struct stat st;
+
+        if ( fd < 0 || fstat( fd, &st ) < 0 || size_t( st.st_size ) < sizeof( header_t ) ) {
+            cerr << "failed to open pileup file: " << path << endl;
+            exit( 1 );
+        }
+
+        len = st.st_size;
+        data = mmap( NULL, len, PROT_READ, MAP_PRIVATE, fd, 0 );
+        close( fd );
+
+        if ( data == MAP_FAILED ) {
+            cerr << "failed to map pileup file: " << path << endl;
+            exit( 1 );
+        }
+
+        if ( !pileup_ok( reinterpret_cast< const char * >( data ), len ) ) {
+            cerr << "invalid pileup file: " << path << endl;
+            exit( 1 );
+        }
+
+        header = reinterpret_cast< const header_t * >( data );
+
+        ncol = header->ncol;
+        cols = reinterpret_cast< const char * >( data ) + sizeof( header_t );
+        obs = cols + header->ncol * sizeof( column_t );
+        nucs = obs + header->nobs * sizeof( obs_t );
+    }
+
+
+    pileup_t::~pileup_t()
+    {
+        if ( data != MAP_FAILED )
+            munmap( data, len );
+    }
+
+
+    size_t pileup_t::size() const
+    {
+        return ncol;
+    }
+
+
+    // materialize column i into cov
+    void pileup_t::get( const size_t i, cov_t & cov ) const
+    {
+        const column_t * const column = reinterpret_cast< const column_t * >( cols ) + i;
+        const obs_t * const first = reinterpret_cast< const obs_t * >( obs ) + column->obs;
+
+        cov.col = column->col;
+        cov.op = op_t( column->op );
+        cov.obs.clear();
+
+        for ( const obs_t * o = first; o != first + column->nobs; ++o ) {
+            elem_t elem;
+
+            elem.assign( nucs + o->nuc, nucs + o->nuc + o->len );
+            cov.obs.emplace( std::move( elem ), o->count );
         }
     }
 }
@@ -1,4 +1,5 @@
 
+#include <cstddef>
 #include <list>
 #include <map>
 #include <vector>
@@ -27,10 +28,62 @@ namespace coverage
         cov_t( const int col, const aligned::op_t op );
     };
 
+    // a read-only, memory-mapped view of a pileup written by coverage_t::save
+    class pileup_t
+    {
+    private:
+        void * data;
+        size_t len;
+        size_t ncol;
+        const char * cols;
+        const char * obs;
+        const char * nucs;
+
+        // we own the mapping, so no copies
+        pileup_t( const pileup_t & );
+        pileup_t & operator=( const pileup_t & );
+
+    public:
+        pileup_t( const char * path );
+        ~pileup_t();
+
+        size_t size() const;
+        void get( const size_t i, cov_t & cov ) const;
+    };
+
+    // columns are ordered by position, with a column's insertions following its match
+    inline
+    bool col_cmp( const int col_a, const int op_a, const int col_b, const int op_b )
+    {
+        const int rank_a = ( op_a == aligned::INS ) ? 16 : op_a, rank_b = ( op_b == aligned::INS ) ? 16 : op_b;
+
+        if ( col_a != col_b )
+            return col_a < col_b;
+
+        return rank_a < rank_b;
+    }
+
+    // coverage_t keeps stats::COVERAGE abreast of its size, though only for
+    // what goes through its own methods; clear() and friends go unaccounted
     class coverage_t : public std::list< cov_t >
     {
+    private:
+        // scratch space reused across positions and reads by include()
+        elem_t elem;
+
     public:
+        coverage_t();
+        coverage_t( const coverage_t & other );
+        coverage_t( coverage_t && other );
+        coverage_t & operator=( const coverage_t & other );
+        coverage_t & operator=( coverage_t && other );
+        ~coverage_t();
+
+        long bytes() const;
         void include( const aligned::aligned_t & read );
+        void release( const int col, std::list< cov_t > & done );
+        void merge( const pileup_t & pileup );
+        bool save( const char * path ) const;
     };
 }
 
@@ -0,0 +1,18 @@
+
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+// HOT_KERNEL compiles a function twice, for AVX2 and for the baseline target,
+// and the dynamic loader picks one for the CPU it finds itself on; so one
+// binary runs anywhere, and runs the wider code where it can. AVX2 alone,
+// and not FMA, so that results don't depend on the CPU they're computed on.
+// This takes GCC 6 or later on x86-64 and glibc (for ifunc), and anywhere
+// else, or with -DNO_DISPATCH, HOT_KERNEL does nothing
+#if defined( __GNUC__ ) && !defined( __clang__ ) && __GNUC__ >= 6 && \
+        defined( __x86_64__ ) && defined( __linux__ ) && !defined( NO_DISPATCH )
+#define HOT_KERNEL __attribute__(( target_clones( "avx2", "default" ) ))
+#else
+#define HOT_KERNEL
+#endif
+
+#endif // DISPATCH_H
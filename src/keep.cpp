@@ -0,0 +1,174 @@
+
+#include <climits>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "coverage.hpp"
+#include "keep.hpp"
+
+
+using std::make_pair;
+using std::map;
+using std::pair;
+using std::vector;
+
+using aligned::INS;
+using coverage::coverage_t;
+using coverage::elem_t;
+
+
+namespace keep
+{
+    keep_t::keep_t( const coverage_t & coverage ) :
+        offset( 0 ),
+        mask( 0 )
+    {
+        coverage_t::const_iterator cit;
+        map< elem_t, int >::const_iterator it;
+        unsigned nins = 0, size = 1;
+
+        if ( coverage.empty() )
+            return;
+
+        offset = coverage.front().col;
+        match.resize( coverage.back().col - offset + 1, 0 );
+
+        for ( cit = coverage.begin(); cit != coverage.end(); ++cit ) {
+            if ( cit->op == INS ) {
+                for ( it = cit->obs.begin(); it != cit->obs.end(); ++it )
+                    if ( it->second )
+                        ++nins;
+                continue;
+            }
+
+            for ( it = cit->obs.begin(); it != cit->obs.end(); ++it )
+                if ( it->second && it->first.size() == 1 )
+                    match[ cit->col - offset ] |= 1 << ( it->first[ 0 ] & 0xF );
+        }
+
+        // keep the table at most half full
+        for ( ; size < 2 * nins; size *= 2 );
+
+        ins.resize( size, make_pair( INT_MIN, uint64_t( 0 ) ) );
+        text.resize( size, make_pair( 0u, 0u ) );
+        mask = size - 1;
+
+        for ( cit = coverage.begin(); cit != coverage.end(); ++cit ) {
+            if ( cit->op != INS )
+                continue;
+
+            for ( it = cit->obs.begin(); it != cit->obs.end(); ++it ) {
+                if ( !it->second )
+                    continue;
+
+                const char * const allele = &it->first[ 0 ];
+                const int len = it->first.size();
+                const uint64_t key = allele_key( allele, len );
+                uint64_t i = slot( cit->col, key );
+
+                for ( ; ins[ i ].first != INT_MIN; i = ( i + 1 ) & mask )
+                    if ( same( i, cit->col, key, allele, len ) )
+                        break;
+
+                if ( ins[ i ].first != INT_MIN )
+                    continue;
+
+                ins[ i ] = make_pair( cit->col, key );
+
+                if ( len > 14 ) {
+                    text[ i ] = make_pair( uint32_t( alleles.size() ), uint32_t( len ) );
+
+                    for ( int j = 0; j < len; ++j )
+                        alleles.push_back( allele[ j ] & 0xF );
+                }
+            }
+        }
+    }
+
+
+    inline
+    uint64_t keep_t::slot( const int col, const uint64_t key ) const
+    {
+        uint64_t h = key ^ ( uint64_t( uint32_t( col ) ) * 0x9E3779B97F4A7C15ULL );
+
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+
+        return h & mask;
+    }
+
+
+    // does slot i hold allele nucs at col? keys of up to 14 bases are the
+    // allele itself, longer ones are only hashes, so compare the text too
+    inline
+    bool keep_t::same( const uint64_t i, const int col, const uint64_t key, const char * const nucs, const int len ) const
+    {
+        if ( ins[ i ].first != col || ins[ i ].second != key )
+            return false;
+
+        if ( len <= 14 )
+            return true;
+
+        if ( int( text[ i ].second ) != len )
+            return false;
+
+        for ( int j = 0; j < len; ++j )
+            if ( alleles[ text[ i ].first + j ] != ( nucs[ j ] & 0xF ) )
+                return false;
+
+        return true;
+    }
+
+
+    // alleles of up to 14 bases are packed exactly alongside their length,
+    // longer ones are represented by a 56-bit FNV-1a hash, and set apart
+    // from packed ones by their top byte
+    uint64_t keep_t::allele_key( const char * const nucs, const int len )
+    {
+        uint64_t key;
+
+        if ( len <= 14 ) {
+            key = uint64_t( len ) << 56;
+
+            for ( int i = 0; i < len; ++i )
+                key |= uint64_t( nucs[ i ] & 0xF ) << ( 4 * i );
+
+            return key;
+        }
+
+        key = 0xCBF29CE484222325ULL;
+
+        for ( int i = 0; i < len; ++i ) {
+            key ^= uint64_t( nucs[ i ] & 0xF );
+            key *= 0x100000001B3ULL;
+        }
+
+        return ( uint64_t( 0xFF ) << 56 ) | ( key & 0x00FFFFFFFFFFFFFFULL );
+    }
+
+
+    bool keep_t::keep_match( const int col, const char nuc ) const
+    {
+        if ( col < offset || col - offset >= int( match.size() ) )
+            return false;
+
+        return match[ col - offset ] & ( 1 << ( nuc & 0xF ) );
+    }
+
+
+    bool keep_t::keep_ins( const int col, const char * const nucs, const int len ) const
+    {
+        const uint64_t key = allele_key( nucs, len );
+
+        if ( ins.empty() )
+            return false;
+
+        for ( uint64_t i = slot( col, key ); ins[ i ].first != INT_MIN; i = ( i + 1 ) & mask )
+            if ( same( i, col, key, nucs, len ) )
+                return true;
+
+        return false;
+    }
+}
@@ -0,0 +1,44 @@
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include "coverage.hpp"
+
+
+#ifndef KEEP_H
+#define KEEP_H
+
+namespace keep
+{
+    // which alleles of a pileup are "real", compiled from the pileup's
+    // observation counts (non-zero means keep) into a read-only table:
+    // a bitset over the 16 nucleotide codes for every match column,
+    // and a hash set of ( column, allele ) pairs for insertions, where
+    // alleles too long to pack into a key are hashed, and kept verbatim
+    // besides so that a hash collision can't keep the wrong one
+    class keep_t
+    {
+    private:
+        int offset;
+        std::vector< uint16_t > match;
+        std::vector< std::pair< int, uint64_t > > ins;
+        // for every slot of ins holding a long allele, ( offset, length ) in alleles
+        std::vector< std::pair< uint32_t, uint32_t > > text;
+        std::vector< char > alleles;
+        uint64_t mask;
+
+        uint64_t slot( const int col, const uint64_t key ) const;
+        bool same( const uint64_t i, const int col, const uint64_t key, const char * const nucs, const int len ) const;
+
+    public:
+        keep_t( const coverage::coverage_t & coverage );
+
+        bool keep_match( const int col, const char nuc ) const;
+        bool keep_ins( const int col, const char * const nucs, const int len ) const;
+
+        static uint64_t allele_key( const char * const nucs, const int len );
+    };
+}
+
+#endif // KEEP_H
@@ -8,29 +8,120 @@
 
 namespace math
 {
+    // log( n! ) for 0 <= n < size(), shared by every caller
+    inline
+    std::vector< double > & lg_factorial_table()
+    {
+        static std::vector< double > table( 1, 0.0 );
+        return table;
+    }
+
+
+    // grow the log-factorial table to cover n; not thread-safe,
+    // so call this before entering any parallel region
+    inline
+    void lg_factorial_reserve( const int n )
+    {
+        std::vector< double > & table = lg_factorial_table();
+
+        for ( int i = table.size(); i <= n; ++i )
+            table.push_back( lgamma( i + 1.0 ) );
+    }
+
+
+    inline
+    double lg_factorial( const int n )
+    {
+        const std::vector< double > & table = lg_factorial_table();
+
+        if ( n < int( table.size() ) )
+            return table[ n ];
+
+        return lgamma( n + 1.0 );
+    }
+
+
     inline
     double lg_choose( const int n, const int k )
     {
-        double rv = 0.0;
+        return lg_factorial( n ) - lg_factorial( k ) - lg_factorial( n - k );
+    }
 
-        for ( int i = 1; i <= k; ++i )
-            rv += std::log( n - k + i ) - std::log( i );
 
-        return rv;
+    // continued fraction for the regularized incomplete beta function,
+    // by the modified Lentz method (Numerical Recipes, 6.4)
+    inline
+    double betacf( const double a, const double b, const double x )
+    {
+        const double eps = 1e-15, tiny = 1e-300;
+        const double qab = a + b, qap = a + 1.0, qam = a - 1.0;
+        double c = 1.0, d = 1.0 - qab * x / qap, h;
+
+        if ( std::fabs( d ) < tiny )
+            d = tiny;
+
+        d = 1.0 / d;
+        h = d;
+
+        for ( int m = 1; m <= 10000; ++m ) {
+            const int m2 = 2 * m;
+            double aa = m * ( b - m ) * x / ( ( qam + m2 ) * ( a + m2 ) ), del;
+
+            d = 1.0 + aa * d;
+            if ( std::fabs( d ) < tiny )
+                d = tiny;
+            c = 1.0 + aa / c;
+            if ( std::fabs( c ) < tiny )
+                c = tiny;
+            d = 1.0 / d;
+            h *= d * c;
+
+            aa = -( a + m ) * ( qab + m ) * x / ( ( a + m2 ) * ( qap + m2 ) );
+            d = 1.0 + aa * d;
+            if ( std::fabs( d ) < tiny )
+                d = tiny;
+            c = 1.0 + aa / c;
+            if ( std::fabs( c ) < tiny )
+                c = tiny;
+            d = 1.0 / d;
+            del = d * c;
+            h *= del;
+
+            if ( std::fabs( del - 1.0 ) < eps )
+                break;
+        }
+
+        return h;
     }
 
 
+    // log P( X >= k ) for X ~ Binomial( cov, bg ),
+    // computed as log I_bg( k, cov - k + 1 ) so tiny p-values don't underflow
     inline
-    double prob_background( const double lg_bg, const double lg_invbg, const int cov, const int k )
+    double lg_prob_background( const double lg_bg, const double lg_invbg, const int cov, const int k )
     {
-        double rv = std::exp( cov * lg_invbg );
+        if ( k <= 0 )
+            return 0.0;
+
+        if ( k > cov )
+            return -HUGE_VAL;
 
-        for ( int i = 1; i < k; ++i )
-            rv += std::exp( lg_choose( cov, i ) + i * lg_bg + ( cov - i ) * lg_invbg );
+        const double a = k, b = cov - k + 1, x = std::exp( lg_bg );
+        // log( x^a ( 1 - x )^b / B( a, b ) )
+        const double lg_front = a * lg_bg + b * lg_invbg
+            - lg_factorial( k - 1 ) - lg_factorial( cov - k ) + lg_factorial( cov );
 
-        rv = 1.0 - rv;
+        if ( x < ( a + 1.0 ) / ( a + b + 2.0 ) )
+            return lg_front + std::log( betacf( a, b, x ) / a );
+
+        return log1p( -std::exp( lg_front + std::log( betacf( b, a, std::exp( lg_invbg ) ) / b ) ) );
+    }
 
-        return ( rv < 0.0 ) ? 0.0 : rv;
+
+    inline
+    double prob_background( const double lg_bg, const double lg_invbg, const int cov, const int k )
+    {
+        return std::exp( lg_prob_background( lg_bg, lg_invbg, cov, k ) );
     }
 
 
@@ -1,13 +1,18 @@
 
 #include <algorithm>
-#include <cstdio>
+#include <iostream>
 #include <utility>
 
 #include "args.hpp"
 #include "bamfile.hpp"
 #include "merge.hpp"
+#include "progress.hpp"
+#include "spill.hpp"
+#include "stats.hpp"
 #include "util.hpp"
 
+using std::cerr;
+using std::endl;
 using std::make_pair;
 using std::pair;
 using std::sort;
@@ -18,6 +23,7 @@ using aligned::aligned_t;
 using aligned::op_t;
 using aligned::pos_t;
 using bamfile::bamfile_t;
+using spill::store_t;
 using util::bits2nuc;
 
 
@@ -52,15 +58,39 @@ namespace merge
     }
 
 
-    cluster_t::cluster_t( const aligned_t & seq ) :
-        ncontrib( seq.ncontrib ? seq.ncontrib : 1 )
+    void cluster_t::swap( cluster_t & other )
+    {
+        const int n = ncontrib;
+
+        vector< nuc_t, stats::allocator_t< nuc_t, stats::CLUSTERS > >::swap( other );
+        ncontrib = other.ncontrib;
+        other.ncontrib = n;
+    }
+
+
+    cluster_t::cluster_t( const aligned_t & seq )
+    {
+        from_aligned( seq );
+    }
+
+
+    void cluster_t::from_aligned( const aligned_t & seq )
     {
         aligned_t::const_iterator it;
         vector< pair< char, char > >::const_iterator jt;
+        unsigned n = 0;
+
+        ncontrib = seq.ncontrib ? seq.ncontrib : 1;
+
+        for ( it = seq.begin(); it != seq.end(); ++it )
+            n += it->size();
+
+        clear();
+        reserve( n );
 
         for ( it = seq.begin(); it != seq.end(); ++it )
             for ( jt = it->begin(); jt != it->end(); ++jt )
-                push_back( nuc_t( it->col, it->op, jt->first, jt->second ) );
+                emplace_back( it->col, it->op, jt->first, jt->second );
     }
 
 
@@ -79,6 +109,22 @@ namespace merge
     }
 
 
+    // the part of the cluster within [ begin, end )
+    cluster_t cluster_t::clip( const int begin, const int end ) const
+    {
+        cluster_t::const_iterator it;
+        cluster_t clipped;
+
+        clipped.ncontrib = ncontrib;
+
+        for ( it = this->begin(); it != this->end(); ++it )
+            if ( it->col >= begin && it->col < end )
+                clipped.push_back( *it );
+
+        return clipped;
+    }
+
+
     inline
     int mean( vector< int > & data )
     {
@@ -113,7 +159,8 @@ namespace merge
                 data.push_back( make_pair( it->nuc, it->qual ) );
             }
             else {
-                cluster.push_back( pos_t( col, op, data, mean( cov ) ) );
+                // data is left empty, and refilled below
+                cluster.emplace_back( col, op, std::move( data ), mean( cov ) );
                 col = it->col;
                 op = it->op;
                 cov.clear();
@@ -123,7 +170,7 @@ namespace merge
             }
         }
 
-        cluster.push_back( pos_t( col, op, data, mean( cov ) ) );
+        cluster.emplace_back( col, op, std::move( data ), mean( cov ) );
 
         cluster.ncontrib = ncontrib;
 
@@ -144,15 +191,36 @@ namespace merge
         const bool tol_gaps
         ) const
     {
-        cluster_t::const_iterator i = begin(), j = other.begin();
         cluster_t m;
+
+        merge( other, min_overlap, tol_ambigs, tol_gaps, m );
+
+        return m;
+    }
+
+
+    bool cluster_t::merge(
+        const cluster_t & other,
+        const int min_overlap,
+        const bool tol_ambigs,
+        const bool tol_gaps,
+        cluster_t & m
+        ) const
+    {
+        cluster_t::const_iterator i = begin(), j = other.begin();
         int overlap = 0;
 
+        m.clear();
+        m.ncontrib = 0;
+
         if ( i == end() || j == other.end() )
-            return m;
+            return false;
 
         if ( rpos() < other.lpos() + min_overlap && other.rpos() < lpos() + min_overlap )
-            return m;
+            return false;
+
+        // m never outgrows the two of us, so it is never copied as it grows
+        m.reserve( size() + other.size() );
 
         if ( i->col < j->col )
             for ( ; i->col < j->col && i != end(); m.push_back( *( i++ ) ) );
@@ -174,12 +242,10 @@ namespace merge
                 if ( i->nuc == j->nuc || ( tol_ambigs && i->nuc & j->nuc ) ) {
                     if ( i->nuc == j->nuc )
                         ++overlap;
-                    m.push_back(
-                        nuc_t(
-                            i->col, i->op,
-                            MIN( i->nuc, j->nuc ), MAX( i->qual, j->qual ),
-                            i->cov + j->cov
-                            )
+                    m.emplace_back(
+                        i->col, i->op,
+                        MIN( i->nuc, j->nuc ), MAX( i->qual, j->qual ),
+                        i->cov + j->cov
                         );
                     ++i;
                     ++j;
@@ -213,12 +279,24 @@ namespace merge
 
         m.ncontrib = ncontrib + other.ncontrib;
 
-        return m;
+        return true;
 
 abort:
         m.clear();
 
-        return m;
+        return false;
+    }
+
+
+    // every thread's cluster to merge into, kept from one attempt to the next
+    // so that attempts, nearly all of which fail, allocate nothing once it has
+    // grown; a successful merge swaps it into place, leaving it the old cluster
+    inline
+    cluster_t & scratch()
+    {
+        static thread_local cluster_t merged;
+
+        return merged;
     }
 
 
@@ -227,40 +305,53 @@ abort:
         const int min_overlap,
         const bool tol_ambigs,
         const bool tol_gaps,
-        vector< cluster_t > & clusters
+        vector< cluster_t > & clusters,
+        const bool verbose
         )
     {
+        stats::scope_t scope( stats::MERGE );
+        long nattempt = 0, nreject = 0, nmerge = 0;
         bool repeat;
 
         do {
             repeat = false;
 
-            fprintf( stderr, "\rprocessed: %9u reads (%6lu clusters)", nread, clusters.size() );
-            fflush( stderr );
+            if ( verbose )
+                progress::update( nread, clusters.size() );
 
             sort( clusters.begin(), clusters.end(), ncontrib_cmp );
 
             for ( int i = 0; i < int( clusters.size() ); ++i ) {
                 bool stop = false;
-                #pragma omp parallel for
+                #pragma omp parallel for reduction( +:nattempt, nreject )
                 for ( int j = i + 1; j < int( clusters.size() ); ++j ) {
                     if ( stop )
                         continue;
                     
-                    cluster_t merged = clusters[ i ].merge( clusters[ j ], min_overlap, tol_ambigs, tol_gaps );
-                    if ( merged.size() ) {
+                    cluster_t & merged = scratch();
+                    ++nattempt;
+                    if ( !clusters[ i ].merge( clusters[ j ], min_overlap, tol_ambigs, tol_gaps, merged ) )
+                        ++nreject;
+                    else {
                         #pragma omp critical
                         if ( !stop ) {
                             // replace i and remove j
-                            clusters[ i ] = merged;
+                            clusters[ i ].swap( merged );
                             clusters.erase( clusters.begin() + j );
                             repeat = stop = true;
                             #pragma omp flush( stop )
                         }
                     }
                 }
+
+                if ( stop )
+                    ++nmerge;
             }
         } while ( repeat );
+
+        stats::add( stats::MERGE_ATTEMPTS, nattempt );
+        stats::add( stats::MERGE_SUCCESSES, nmerge );
+        stats::add( stats::MERGE_REJECTS, nreject );
     }
 
 
@@ -276,90 +367,307 @@ abort:
     }
 
 
+    // merge read into the first cluster that takes it, returning false if none does
+    bool merge_into(
+        const cluster_t & read,
+        const int min_overlap,
+        const bool tol_ambigs,
+        const bool tol_gaps,
+        vector< cluster_t > & clusters
+        )
+    {
+        long nattempt = 0, nreject = 0;
+        bool stop = false;
+
+        #pragma omp parallel for reduction( +:nattempt, nreject )
+        for ( int i = 0; i < int( clusters.size() ); ++i ) {
+            if ( stop )
+                continue;
+
+            cluster_t & merged = scratch();
+
+            ++nattempt;
+
+            if ( !clusters[ i ].merge( read, min_overlap, tol_ambigs, tol_gaps, merged ) )
+                ++nreject;
+            else {
+                #pragma omp critical
+                if ( !stop ) {
+                    clusters[ i ].swap( merged );
+                    stop = true;
+                    #pragma omp flush( stop )
+                }
+            }
+        }
+
+        stats::add( stats::MERGE_ATTEMPTS, nattempt );
+        stats::add( stats::MERGE_SUCCESSES, stop ? 1 : 0 );
+        stats::add( stats::MERGE_REJECTS, nreject );
+
+        return stop;
+    }
+
+
+    // merge read into the first cluster that takes it, or start a new one
+    void merge_read(
+        const cluster_t & read,
+        const int min_overlap,
+        const bool tol_ambigs,
+        const bool tol_gaps,
+        vector< cluster_t > & clusters
+        )
+    {
+        if ( !merge_into( read, min_overlap, tol_ambigs, tol_gaps, clusters ) )
+            clusters.push_back( read );
+    }
+
+
+    void merge_read(
+        cluster_t && read,
+        const int min_overlap,
+        const bool tol_ambigs,
+        const bool tol_gaps,
+        vector< cluster_t > & clusters
+        )
+    {
+        if ( !merge_into( read, min_overlap, tol_ambigs, tol_gaps, clusters ) )
+            clusters.push_back( std::move( read ) );
+    }
+
+
+    // as below, but for reads already in memory, e.g. those of a window;
+    // reads too short to ever merge are dropped, and nothing is reported
+    vector< cluster_t > merge_reads(
+        const vector< cluster_t > & reads,
+        const int min_overlap,
+        const bool tol_ambigs,
+        const bool tol_gaps
+        )
+    {
+        vector< cluster_t >::const_iterator read;
+        vector< cluster_t > clusters;
+        unsigned merge_size = MERGE_SIZE, nread = 1;
+
+        for ( read = reads.begin(); read != reads.end(); ++read, ++nread ) {
+            if ( read->size() < unsigned( min_overlap ) )
+                continue;
+
+            stats::scope_t scope( stats::MERGE );
+
+            merge_read( *read, min_overlap, tol_ambigs, tol_gaps, clusters );
+
+            if ( clusters.size() >= merge_size ) {
+                merge_clusters( nread, min_overlap, tol_ambigs, tol_gaps, clusters, false );
+                merge_size *= 2;
+            }
+        }
+
+        merge_clusters( nread, min_overlap, tol_ambigs, tol_gaps, clusters, false );
+
+        sort( clusters.begin(), clusters.end(), ncontrib_cmp );
+
+        return clusters;
+    }
+
+
+    // spill the clusters ending before col, which reads starting at or after
+    // col can no longer reach, and if that doesn't do, every cluster
+    bool spill_clusters( const int col, vector< cluster_t > & clusters, store_t & store )
+    {
+        vector< cluster_t > cold;
+        unsigned nwarm = 0;
+
+        for ( unsigned i = 0; i < clusters.size(); ++i ) {
+            if ( clusters[ i ].rpos() < col )
+                cold.push_back( std::move( clusters[ i ] ) );
+            else
+                clusters[ nwarm++ ].swap( clusters[ i ] );
+        }
+
+        clusters.resize( nwarm );
+
+        if ( !cold.empty() && !store.spill( cold ) )
+            return false;
+
+        if ( stats::over_budget() && !clusters.empty() && !store.spill( clusters ) )
+            return false;
+
+        return true;
+    }
+
+
+    // the final pass over spilled clusters, which come back sorted by lpos():
+    // every cluster is merged into those it overlaps, and those are set aside
+    // into done once nothing to come can reach them
+    bool merge_spilled(
+        store_t & store,
+        const int min_overlap,
+        const bool tol_ambigs,
+        const bool tol_gaps,
+        vector< cluster_t > & done
+        )
+    {
+        vector< cluster_t > active;
+        cluster_t cluster;
+        unsigned nmerged = 0;
+
+        if ( !store.rewind() )
+            return false;
+
+        done.reserve( store.size() );
+
+        while ( store.next( cluster ) ) {
+            unsigned nactive = 0;
+            bool cold = false;
+
+            for ( unsigned i = 0; !cold && i < active.size(); ++i )
+                cold = active[ i ].rpos() < cluster.lpos();
+
+            // some are going cold, so give them a last chance to merge
+            if ( cold ) {
+                merge_clusters( nmerged, min_overlap, tol_ambigs, tol_gaps, active, false );
+
+                for ( unsigned i = 0; i < active.size(); ++i ) {
+                    if ( active[ i ].rpos() < cluster.lpos() )
+                        done.push_back( std::move( active[ i ] ) );
+                    else
+                        active[ nactive++ ].swap( active[ i ] );
+                }
+
+                active.resize( nactive );
+            }
+
+            // store.next() refills cluster whether or not it's moved from
+            merge_read( std::move( cluster ), min_overlap, tol_ambigs, tol_gaps, active );
+            ++nmerged;
+        }
+
+        merge_clusters( nmerged, min_overlap, tol_ambigs, tol_gaps, active, false );
+
+        for ( unsigned i = 0; i < active.size(); ++i )
+            done.push_back( std::move( active[ i ] ) );
+
+        return store.good();
+    }
+
+
     vector< aligned_t > merge_reads(
         bamfile_t & bamfile,
         const int min_overlap,
         const bool tol_ambigs,
         const bool tol_gaps,
-        const bool discard
+        bamfile_t * const discard
         )
     {
         vector< cluster_t >::iterator cluster;
         vector< cluster_t > clusters;
-        vector< aligned_t > discards, rv;
+        vector< aligned_t > rv;
+        store_t store;
         bam1_t * const bam = bam_init1();
+        // every read is decoded into these, which keep their storage across reads
+        aligned_t orig;
+        cluster_t read;
         unsigned merge_size = MERGE_SIZE, nread = 1;
+        // what a spill can't free (read, the merge scratch) stays tracked, and
+        // may alone exceed the budget: rather than spill after every read then,
+        // a run per read, wait for memory to double past what's left
+        long spill_floor = 0;
+        bool warned = false;
 
         if ( !bam )
             goto error;
 
-        for ( ; bamfile.next( bam ); ++nread ) {
-            aligned_t orig( bam );
-            cluster_t read( orig );
-            bool stop = false;
+        progress::start( "reads", "clusters" );
+
+        for ( ; ; ++nread ) {
+            stats::scope_t decode( stats::DECODE );
+
+            if ( !bamfile.next( bam ) )
+                break;
+
+            orig.from_bam( bam );
+
+            decode.stop();
+
+            stats::scope_t convert( stats::CONVERT );
+
+            read.from_aligned( orig );
+
+            convert.stop();
 
             /*
             if ( nread % 1000 == 0 )
                 sort( clusters.begin(), clusters.end(), ncontrib_cmp );
             */
 
+            // too short to ever merge, so straight out to discard, if we have one
             if ( read.size() < unsigned( min_overlap ) ) {
-                if ( !discard )
-                    discards.push_back( orig );
+                if ( discard && !discard->write( bam ) )
+                    goto error;
                 continue;
             }
 
-            #pragma omp parallel for
-            for ( int i = 0; i < int( clusters.size() ); ++i ) {
-                if ( stop )
-                    continue;
-
-                cluster_t merged = clusters[ i ].merge( read, min_overlap, tol_ambigs, tol_gaps );
-
-                if ( merged.size() ) {
-                    #pragma omp critical
-                    if ( !stop ) {
-                        clusters[ i ] = merged;
-                        stop = true;
-                        #pragma omp flush( stop )
-                    }
-                }
-            }
+            stats::scope_t scope( stats::MERGE );
 
-            if ( !stop )
-                clusters.push_back( read );
+            // a new cluster is a copy, sized to fit, rather than read itself
+            merge_read( read, min_overlap, tol_ambigs, tol_gaps, clusters );
 
             if ( clusters.size() >= merge_size ) {
                 merge_clusters( nread, min_overlap, tol_ambigs, tol_gaps, clusters );
                 merge_size *= 2;
             }
 
-            if ( nread % 100 == 0 ) {
-                fprintf( stderr, "\rprocessed: %9u reads (%6lu clusters)", nread, clusters.size() );
-                fflush( stderr );
+            progress::update( nread, clusters.size() );
+
+            // rather than wait on the kernel to kill us, make room on disk
+            if ( stats::over_budget() && stats::tracked() > spill_floor ) {
+                if ( !spill_clusters( read.lpos(), clusters, store ) )
+                    goto error;
+
+                if ( stats::over_budget() && !warned ) {
+                    cerr << "warning: the memory budget is below the " << stats::tracked()
+                         << " bytes merging needs regardless, and will be exceeded" << endl;
+                    warned = true;
+                }
+
+                spill_floor = stats::over_budget() ? 2 * stats::tracked() : 0;
             }
         }
 
         merge_clusters( nread, min_overlap, tol_ambigs, tol_gaps, clusters );
 
-        fprintf( stderr, "\rprocessed: %9u reads (%6lu clusters)\n", nread, clusters.size() );
-        fflush( stderr );
+        progress::update( nread, clusters.size() + store.size() );
+        progress::stop();
+
+        // once anything has been spilled, everything goes through the final pass
+        if ( store.size() ) {
+            vector< cluster_t > done;
+            stats::scope_t scope( stats::MERGE );
+
+            if ( !store.spill( clusters ) || !merge_spilled( store, min_overlap, tol_ambigs, tol_gaps, done ) )
+                goto error;
+
+            clusters.swap( done );
+        }
 
         sort( clusters.begin(), clusters.end(), aln_cmp );
 
-        rv.reserve( clusters.size() + discards.size() );
+        rv.reserve( clusters.size() );
 
-        for ( cluster = clusters.begin(); cluster != clusters.end(); ++cluster )
-            rv.push_back( cluster->to_aligned() );
+        {
+            stats::scope_t scope( stats::CONVERT );
 
-        if ( !discard )
-            clusters.insert( clusters.end(), discards.begin(), discards.end() );
+            for ( cluster = clusters.begin(); cluster != clusters.end(); ++cluster )
+                rv.emplace_back( cluster->to_aligned() );
+        }
 
         bam_destroy1( bam );
 
         return rv;
 
     error:
+        progress::stop();
+
         rv.clear();
 
         bam_destroy1( bam );
@@ -3,8 +3,12 @@
 
 #include "aligned.hpp"
 #include "bamfile.hpp"
+#include "stats.hpp"
 
 
+#ifndef MERGE_H
+#define MERGE_H
+
 #define MERGE_SIZE 128
 
 
@@ -28,7 +32,7 @@ namespace merge
             );
     };
 
-    class cluster_t : public std::vector< nuc_t >
+    class cluster_t : public std::vector< nuc_t, stats::allocator_t< nuc_t, stats::CLUSTERS > >
     {
     public:
         int ncontrib;
@@ -39,6 +43,13 @@ namespace merge
         int lpos() const;
         int rpos() const;
 
+        // swap nucleotides and ncontrib with other, in constant time
+        void swap( cluster_t & other );
+
+        // become seq, reusing our storage
+        void from_aligned( const aligned::aligned_t & seq );
+
+        cluster_t clip( const int begin, const int end ) const;
         aligned::aligned_t to_aligned() const;
         cluster_t merge(
             const cluster_t & other,
@@ -46,6 +57,14 @@ namespace merge
             const bool tol_ambigs,
             const bool tol_gaps
             ) const;
+        // as above, but into m, reusing its storage; false if we don't merge
+        bool merge(
+            const cluster_t & other,
+            const int min_overlap,
+            const bool tol_ambigs,
+            const bool tol_gaps,
+            cluster_t & m
+            ) const;
     };
 
     bool ncontrib_cmp(
@@ -58,14 +77,45 @@ namespace merge
         const int min_overlap,
         const bool tol_ambigs,
         const bool tol_gaps,
+        std::vector< cluster_t > & clusters,
+        const bool verbose = true
+        );
+
+    void merge_read(
+        const cluster_t & read,
+        const int min_overlap,
+        const bool tol_ambigs,
+        const bool tol_gaps,
         std::vector< cluster_t > & clusters
         );
 
+    // as above, but read is moved into clusters if it starts a new cluster
+    void merge_read(
+        cluster_t && read,
+        const int min_overlap,
+        const bool tol_ambigs,
+        const bool tol_gaps,
+        std::vector< cluster_t > & clusters
+        );
+
+    std::vector< cluster_t > merge_reads(
+        const std::vector< cluster_t > & reads,
+        const int min_overlap,
+        const bool tol_ambigs,
+        const bool tol_gaps
+        );
+
+    // merge the reads of bamfile into clusters, or return nothing on error;
+    // reads too short to merge are written out to discard as they come,
+    // if it isn't NULL, which must have its header written already.
+    // Past the memory budget (stats::set_budget), clusters are spilled to disk
     std::vector< aligned::aligned_t > merge_reads(
         bamfile::bamfile_t & bamfile,
         const int min_overlap,
         const bool tol_ambigs,
         const bool tol_gaps,
-        const bool discard
+        bamfile::bamfile_t * const discard = NULL
         );
 }
+
+#endif // MERGE_H
@@ -6,6 +6,7 @@
 #include <cstring>
 
 #include "args.hpp"
+#include "stats.hpp"
 
 
 using bamfile::READ;
@@ -18,11 +19,11 @@ using bamfile::bamfile_t;
 #define TO_STR(x) STRIFY(x)
 
 const char usage[] =
-    "usage: " EXEC " [-h] "
+    "usage: " EXEC " [-h] [--stats-json PATH] [--memory-budget SIZE] "
     "[-D BAM_DISCARD] "
     "[-o MIN_OVERLAP] "
     "[-r MIN_READS] "
-    "[-g] [-a] "
+    "[-g] [-a] [-q] "
     "(-B BAM_IN BAM_OUT)\n";
 
 const char help_msg[] =
@@ -34,12 +35,16 @@ const char help_msg[] =
     "optional arguments:\n"
     "  -D BAM_DISCARD           BAM output for discarded clusters and reads\n"
     "  -h, --help               show this help message and exit\n"
+    "  --stats-json PATH        write per-stage timings and counters to PATH as JSON on exit\n"
+    "  --memory-budget SIZE     spill clusters to disk once the memory tracked exceeds SIZE,\n"
+    "                           e.g. 512M or 4G\n"
     "  -o MIN_OVERLAP           minimum overlap between two reads to merge them (default="
                                 TO_STR( DEFAULT_MIN_OVERLAP ) ")\n"
     "  -r MIN_READS             minimum number of contributing reads to report a cluster (default="
                                 TO_STR( DEFAULT_MIN_READS ) ")\n"
     "  -g                       don't tolerate gaps\n"
-    "  -a                       don't tolerate ambigs\n";
+    "  -a                       don't tolerate ambigs\n"
+    "  -q                       don't report progress\n";
 
 inline
 void help()
@@ -63,7 +68,10 @@ args_t::args_t( int argc, const char * argv[] ) :
     min_overlap( DEFAULT_MIN_OVERLAP ),
     min_reads( DEFAULT_MIN_READS ),
     tol_gaps( DEFAULT_TOL_GAPS ),
-    tol_ambigs( DEFAULT_TOL_AMBIGS )
+    tol_ambigs( DEFAULT_TOL_AMBIGS ),
+    quiet( DEFAULT_QUIET ),
+    stats_json( NULL ),
+    memory_budget( 0 )
 {
     int i;
 
@@ -73,6 +81,8 @@ args_t::args_t( int argc, const char * argv[] ) :
 
         if ( arg[0] == '-' && arg[1] == '-' ) {
             if ( !strcmp( &arg[2], "help" ) ) help();
+            else if ( !strcmp( &arg[2], "stats-json" ) ) parse_statsjson( argv[++i] );
+            else if ( !strcmp( &arg[2], "memory-budget" ) ) parse_memorybudget( argv[++i] );
 #if 0
             else if ( !strcmp( &arg[2], "fasta" ) ) parse_fasta( argv[++i] );
             else if ( !strcmp( &arg[2], "fastq" ) ) parse_fastq( argv[++i] );
@@ -93,6 +103,7 @@ args_t::args_t( int argc, const char * argv[] ) :
             else if ( !strcmp( &arg[1], "r" ) ) parse_minreads( argv[++i] );
             else if ( !strcmp( &arg[1], "g" ) ) parse_tolgaps();
             else if ( !strcmp( &arg[1], "a" ) ) parse_tolambigs();
+            else if ( !strcmp( &arg[1], "q" ) ) parse_quiet();
             else
                 ERROR( "unknown argument: %s", arg );
         }
@@ -147,3 +158,22 @@ void args_t::parse_tolambigs()
 {
     tol_ambigs = false;
 }
+
+void args_t::parse_quiet()
+{
+    quiet = true;
+}
+
+void args_t::parse_statsjson( const char * str )
+{
+    if ( !str )
+        ERROR( "missing argument to --stats-json" );
+
+    stats_json = str;
+}
+
+void args_t::parse_memorybudget( const char * str )
+{
+    if ( !str || !stats::parse_bytes( str, memory_budget ) || memory_budget <= 0 )
+        ERROR( "memory budget must be a positive size, e.g. 512M, had: %s", str ? str : "" );
+}
@@ -12,6 +12,7 @@
 #define DEFAULT_MIN_READS 5
 #define DEFAULT_TOL_GAPS true
 #define DEFAULT_TOL_AMBIGS true
+#define DEFAULT_QUIET false
 
 class args_t
 {
@@ -23,6 +24,9 @@ public:
     int min_reads;
     bool tol_gaps;
     bool tol_ambigs;
+    bool quiet;
+    const char * stats_json;
+    long memory_budget;
 
     args_t( int, const char ** );
     ~args_t();
@@ -33,6 +37,9 @@ private:
     void parse_minreads( const char * );
     void parse_tolgaps();
     void parse_tolambigs();
+    void parse_quiet();
+    void parse_statsjson( const char * );
+    void parse_memorybudget( const char * );
 };
 
 #endif // ARGPARSE_H
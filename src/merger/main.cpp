@@ -9,6 +9,8 @@
 #include "args.hpp"
 #include "bamfile.hpp"
 #include "merge.hpp"
+#include "progress.hpp"
+#include "stats.hpp"
 
 using std::cerr;
 using std::endl;
@@ -25,6 +27,16 @@ int main( int argc, const char * argv[] )
     args_t args = args_t( argc, argv );
     bam1_t * const bam = bam_init1();
     unsigned i, j;
+
+    stats::dump_at_exit( args.stats_json, EXEC );
+    stats::set_budget( args.memory_budget );
+
+    if ( args.quiet )
+        progress::disable();
+
+    // short reads are discarded while merging
+    if ( args.bamdiscard )
+        args.bamdiscard->write_header( args.bamin->hdr );
     
     vector< aligned_t >::iterator cluster;
     vector< aligned_t > clusters = merge_reads(
@@ -32,7 +44,7 @@ int main( int argc, const char * argv[] )
         args.min_overlap,
         args.tol_ambigs,
         args.tol_gaps,
-        bool( args.bamdiscard )
+        args.bamdiscard
         );
 
     if ( !bam ) {
@@ -46,38 +58,39 @@ int main( int argc, const char * argv[] )
 
     args.bamout->write_header( args.bamin->hdr );
 
-    if ( args.bamdiscard )
-        args.bamdiscard->write_header( args.bamin->hdr );
+    {
+        stats::scope_t scope( stats::WRITE );
 
-    for ( cluster = clusters.begin(), i = 0, j = 0; cluster != clusters.end(); ++cluster ) {
-        if ( cluster->ncontrib >= args.min_reads ) {
-            char name[ 256 ];
-            snprintf( name, 256, "cluster%u_%dr", i++, cluster->ncontrib );
-            cluster->name += name;
+        for ( cluster = clusters.begin(), i = 0, j = 0; cluster != clusters.end(); ++cluster ) {
+            if ( cluster->ncontrib >= args.min_reads ) {
+                char name[ 256 ];
+                snprintf( name, 256, "cluster%u_%dr", i++, cluster->ncontrib );
+                cluster->name += name;
             
-            if ( !cluster->to_bam( bam ) ) {
-                cerr << "error converting to BAM format" << endl;
-                goto error;
-            }
+                if ( !cluster->to_bam( bam ) ) {
+                    cerr << "error converting to BAM format" << endl;
+                    goto error;
+                }
             
-            if ( !args.bamout->write( bam ) ) {
-                cerr << "error writing to BAM_OUT" << endl;
-                goto error;
-            }
-        }
-        else if ( args.bamdiscard ) {
-            char name[ 256 ];
-            snprintf( name, 256, "cluster%u_%dr", j++, cluster->ncontrib );
-            cluster->name += name;
-
-            if ( !cluster->to_bam( bam ) ) {
-                cerr << "error converting to BAM format" << endl;
-                goto error;
+                if ( !args.bamout->write( bam ) ) {
+                    cerr << "error writing to BAM_OUT" << endl;
+                    goto error;
+                }
             }
+            else if ( args.bamdiscard ) {
+                char name[ 256 ];
+                snprintf( name, 256, "cluster%u_%dr", j++, cluster->ncontrib );
+                cluster->name += name;
+
+                if ( !cluster->to_bam( bam ) ) {
+                    cerr << "error converting to BAM format" << endl;
+                    goto error;
+                }
             
-            if ( !args.bamdiscard->write( bam ) ) {
-                cerr << "error writing to BAM_DISCARD" << endl;
-                goto error;
+                if ( !args.bamdiscard->write( bam ) ) {
+                    cerr << "error writing to BAM_DISCARD" << endl;
+                    goto error;
+                }
             }
         }
     }
@@ -0,0 +1,136 @@
+
+#include <cerrno>
+#include <cstdio>
+
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "progress.hpp"
+
+
+namespace progress
+{
+    pthread_t thread;
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+    bool enabled = true;
+    bool started = false;
+    bool running = false;
+    const char * items_name = "";
+    const char * results_name = "";
+    double period = PROGRESS_INTERVAL;
+    long nitems = 0;
+    long nresults = 0;
+
+
+    inline
+    long load( long & x )
+    {
+        return __sync_fetch_and_add( &x, 0 );
+    }
+
+
+    // on a terminal, overwrite the one line; anywhere else, e.g. a logged pipe,
+    // every report gets a line of its own
+    void report( const bool last )
+    {
+        const bool tty = isatty( fileno( stderr ) );
+
+        fprintf(
+            stderr,
+            "%sprocessed: %9ld %s (%6ld %s)%s",
+            tty ? "\r" : "",
+            load( nitems ),
+            items_name,
+            load( nresults ),
+            results_name,
+            ( last || !tty ) ? "\n" : ""
+            );
+        fflush( stderr );
+    }
+
+
+    void * reporter( void * )
+    {
+        long last = -1;
+
+        pthread_mutex_lock( &mutex );
+
+        while ( running ) {
+            struct timeval now;
+            struct timespec until;
+            long usec;
+
+            gettimeofday( &now, NULL );
+            usec = now.tv_usec + long( 1e6 * period );
+            until.tv_sec = now.tv_sec + usec / 1000000;
+            until.tv_nsec = 1000 * ( usec % 1000000 );
+
+            // woken early only to stop
+            if ( pthread_cond_timedwait( &cond, &mutex, &until ) != ETIMEDOUT )
+                continue;
+
+            if ( load( nitems ) != last ) {
+                last = load( nitems );
+                report( false );
+            }
+        }
+
+        pthread_mutex_unlock( &mutex );
+
+        return NULL;
+    }
+
+
+    void start( const char * items, const char * results, const double interval )
+    {
+        if ( !enabled || started )
+            return;
+
+        items_name = items;
+        results_name = results;
+        period = interval;
+        nitems = 0;
+        nresults = 0;
+        started = true;
+        running = true;
+
+        // without a reporter, there's still the summary
+        if ( pthread_create( &thread, NULL, reporter, NULL ) )
+            running = false;
+    }
+
+
+    void stop()
+    {
+        if ( !started )
+            return;
+
+        if ( running ) {
+            pthread_mutex_lock( &mutex );
+            running = false;
+            pthread_cond_signal( &cond );
+            pthread_mutex_unlock( &mutex );
+
+            pthread_join( thread, NULL );
+        }
+
+        started = false;
+
+        report( true );
+    }
+
+
+    void disable()
+    {
+        enabled = false;
+    }
+
+
+    void update( const long nitem, const long nresult )
+    {
+        __sync_lock_test_and_set( &nitems, nitem );
+        __sync_lock_test_and_set( &nresults, nresult );
+    }
+}
@@ -0,0 +1,26 @@
+
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+// seconds between progress reports
+#define PROGRESS_INTERVAL 1.0
+
+namespace progress
+{
+    // report progress on stderr from a background thread, at most once every
+    // interval seconds and only when something has changed, so that the loop
+    // doing the work only ever updates a pair of counters; reports read
+    // "processed: <nitem> <items> (<nresult> <results>)"
+    void start( const char * items, const char * results, const double interval = PROGRESS_INTERVAL );
+
+    // stop the reporter, and print a final summary line
+    void stop();
+
+    // never report anything, not even the summary
+    void disable();
+
+    // safe to call from any thread, and cheap enough to call on every item
+    void update( const long nitem, const long nresult );
+}
+
+#endif // PROGRESS_H
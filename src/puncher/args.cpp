@@ -4,6 +4,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <vector>
 
 #include "args.hpp"
 
@@ -11,6 +12,8 @@
 using bamfile::READ;
 using bamfile::WRITE;
 using bamfile::bamfile_t;
+using bamfile::region_t;
+using std::vector;
 
 
 // some crazy shit for stringifying preprocessor directives
@@ -18,7 +21,8 @@ using bamfile::bamfile_t;
 #define TO_STR(x) STRIFY(x)
 
 const char usage[] =
-    "usage: " EXEC " [-h] [-c CUTOFF] "
+    "usage: " EXEC " [-h] [--stats-json PATH] [-c CUTOFF] "
+    "[-m MODEL] [-r REGION] [-L BED] [-p PILEUP] [-w PILEUP_OUT] "
     "(-B BAM_IN BAM_OUT)\n";
 
 const char help_msg[] =
@@ -29,8 +33,17 @@ const char help_msg[] =
     "\n"
     "optional arguments:\n"
     "  -h, --help               show this help message and exit\n"
+    "  --stats-json PATH        write per-stage timings and counters to PATH as JSON on exit\n"
     "  -c CUTOFF                mutations with p < CUTOFF will be assumed real (default="
-                                TO_STR( DEFAULT_CUTOFF ) ")\n";
+                                TO_STR( DEFAULT_CUTOFF ) ")\n"
+    "  -m MODEL                 reuse the rate class model in MODEL if it exists,\n"
+    "                           otherwise save the fitted model there\n"
+    "  -r REGION                only process reads overlapping REGION, as chr:begin-end;\n"
+    "                           may be repeated (BAM_IN must be indexed)\n"
+    "  -L BED                   only process reads overlapping the regions of BED (BAM_IN must be indexed)\n"
+    "  -p PILEUP                use the pileup of BAM_IN saved by -w instead of rebuilding it,\n"
+    "                           may be repeated to combine pileups\n"
+    "  -w PILEUP_OUT            save the pileup to PILEUP_OUT for reuse with -p\n";
 
 inline
 void help()
@@ -50,8 +63,12 @@ void help()
 args_t::args_t( int argc, const char * argv[] ) :
     bamin( NULL ),
     bamout( NULL ),
-    cutoff( DEFAULT_CUTOFF )
+    cutoff( DEFAULT_CUTOFF ),
+    model( NULL ),
+    pileup_out( NULL ),
+    stats_json( NULL )
 {
+    vector< const char * > regions, beds;
     int i;
 
     // skip arg[0], it's just the program name
@@ -60,6 +77,7 @@ args_t::args_t( int argc, const char * argv[] ) :
 
         if ( arg[0] == '-' && arg[1] == '-' ) {
             if ( !strcmp( &arg[2], "help" ) ) help();
+            else if ( !strcmp( &arg[2], "stats-json" ) ) parse_statsjson( argv[++i] );
 #if 0
             else if ( !strcmp( &arg[2], "fasta" ) ) parse_fasta( argv[++i] );
             else if ( !strcmp( &arg[2], "fastq" ) ) parse_fastq( argv[++i] );
@@ -76,6 +94,11 @@ args_t::args_t( int argc, const char * argv[] ) :
                 i += 2;
             }
             else if ( !strcmp( &arg[1], "c" ) ) parse_cutoff( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "m" ) ) parse_model( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "r" ) ) regions.push_back( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "L" ) ) beds.push_back( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "p" ) ) parse_pileup( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "w" ) ) parse_pileupout( argv[ ++i ] );
             else
                 ERROR( "unknown argument: %s", arg );
         }
@@ -85,6 +108,21 @@ args_t::args_t( int argc, const char * argv[] ) :
 
     if ( !bamin || !bamout )
         ERROR( "missing required argument -B BAM_IN BAM_OUT" );
+
+    for ( i = 0; i < int( regions.size() ); ++i )
+        parse_region( regions[ i ] );
+
+    for ( i = 0; i < int( beds.size() ); ++i )
+        parse_bed( beds[ i ] );
+
+    // our pileup is over a single reference
+    {
+        const vector< region_t > & regs = bamin->get_regions();
+
+        for ( i = 1; i < int( regs.size() ); ++i )
+            if ( regs[ i ].tid != regs[ 0 ].tid )
+                ERROR( "regions must all lie on the same reference" );
+    }
 }
 
 args_t::~args_t()
@@ -106,3 +144,47 @@ void args_t::parse_cutoff( const char * str )
     if ( cutoff <= 0.0 || cutoff >= 1.0 )
         ERROR( "cutoff must be a real number between 0.0 and 1.0, exclusive" );
 }
+
+void args_t::parse_model( const char * str )
+{
+    if ( !str )
+        ERROR( "missing argument to -m" );
+
+    model = str;
+}
+
+void args_t::parse_pileup( const char * str )
+{
+    if ( !str )
+        ERROR( "missing argument to -p" );
+
+    pileups.push_back( str );
+}
+
+void args_t::parse_pileupout( const char * str )
+{
+    if ( !str )
+        ERROR( "missing argument to -w" );
+
+    pileup_out = str;
+}
+
+void args_t::parse_region( const char * str )
+{
+    if ( !str || !bamin->add_region( str ) )
+        ERROR( "invalid region: %s", str ? str : "" );
+}
+
+void args_t::parse_bed( const char * str )
+{
+    if ( !str || !bamin->add_bed( str ) )
+        ERROR( "invalid BED file: %s", str ? str : "" );
+}
+
+void args_t::parse_statsjson( const char * str )
+{
+    if ( !str )
+        ERROR( "missing argument to --stats-json" );
+
+    stats_json = str;
+}
@@ -1,4 +1,6 @@
 
+#include <vector>
+
 #include "bamfile.hpp"
 
 #ifndef ARGPARSE_H
@@ -15,12 +17,22 @@ public:
     bamfile::bamfile_t * bamin;
     bamfile::bamfile_t * bamout;
     double cutoff;
+    const char * model;
+    std::vector< const char * > pileups;
+    const char * pileup_out;
+    const char * stats_json;
 
     args_t( int, const char ** );
     ~args_t();
 private:
     void parse_bamfile( const char *, const char * );
     void parse_cutoff( const char * );
+    void parse_model( const char * );
+    void parse_pileup( const char * );
+    void parse_pileupout( const char * );
+    void parse_region( const char * );
+    void parse_bed( const char * );
+    void parse_statsjson( const char * );
 };
 
 #endif // ARGPARSE_H
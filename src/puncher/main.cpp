@@ -1,5 +1,6 @@
 
 #include <cmath>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
@@ -13,8 +14,10 @@
 #include "args.hpp"
 #include "bamfile.hpp"
 #include "coverage.hpp"
+#include "keep.hpp"
 #include "math.hpp"
 #include "rateclass.hpp"
+#include "stats.hpp"
 #include "util.hpp"
 
 
@@ -34,17 +37,24 @@ using aligned::aligned_t;
 using coverage::cov_t;
 using coverage::coverage_t;
 using coverage::elem_t;
-using math::prob_background;
+using coverage::pileup_t;
+using keep::keep_t;
+using math::lg_factorial_reserve;
+using math::lg_prob_background;
 using rateclass::params_json_dump;
+using rateclass::params_json_load;
 using rateclass::rateclass_t;
 using util::bits2nuc;
 
 
+// number of reads punched out in parallel at a time
+#define PUNCHOUT_BATCH 4096
+
+
 typedef list< cov_t >::const_iterator cov_citer;
 typedef list< cov_t >::iterator cov_iter;
 typedef map< elem_t, int >::const_iterator obs_citer;
 typedef map< elem_t, int >::iterator obs_iter;
-typedef vector< cov_t >::const_iterator var_citer;
 
 
 inline
@@ -66,162 +76,142 @@ void realloc_data( bam1_t * const bam )
     }
 
     bam->data = data;
+
+    stats::add( stats::ALLOCATIONS );
 }
 
 
-bam1_t * punchout_read(
-        const bam1_t * const in_bam,
-        const vector< cov_t > & variants,
-        const aligned_t & read
-        )
+inline
+bool is_match( const uint32_t cig )
 {
-    aligned_t::const_iterator rit = read.begin();
-    var_citer vit = variants.begin();
-    vector< pair< bool, unsigned > > keep;
-    vector< int > cols;
-
-    bam1_t * const out_bam = bam_init1();
-
-    if ( !out_bam ) {
-        cerr << "memory allocation error" << endl;
-        exit( 1 );
-    }
-
-    out_bam->core = in_bam->core;
-    out_bam->core.l_qseq = 0;
-
-    // build a vector of which positions we're keeping,
-    // and how long our new seq will be
-    for ( ; rit != read.end() && vit != variants.end(); ) {
-
-#if 0
-        cerr << "r: ( " << rit->col << ", " << rit->op == INS << ", ";
-        for ( unsigned j = 0; j < rit->elem.size(); ++j )
-            cerr << bits2nuc( rit->elem[ j ] );
-        cerr << " )" << endl;
-        cerr << "v: ( " << vit->col << ", " << vit->op == INS << " )" << endl;
-#endif
+    const int op = cig & BAM_CIGAR_MASK;
+    return op == BAM_CMATCH || op == BAM_CEQUAL || op == BAM_CDIFF;
+}
 
-        if ( rit->col == vit->col && rit->op == vit->op ) {
-            elem_t elem;
-            obs_citer it;
 
-            rit->get_seq( elem );
-            it = vit->obs.find( elem );
+// scratch space reused across reads, so punching out doesn't allocate in the steady state
+class punchout_t
+{
+public:
+    vector< uint32_t > cigar;
+    vector< uint8_t > seq;
+    vector< uint8_t > qual;
+    elem_t elem;
 
-            if ( it == vit->obs.end() ) {
-                cerr << "unknown variant observed, which is weird...( 1 )" << endl;
-                exit( 1 );
-            }
+    void clear()
+    {
+        cigar.clear();
+        seq.clear();
+        qual.clear();
+    }
 
-            if ( it->second ) {
-                keep.push_back( make_pair( true, it->first.size() ) );
-                cols.push_back( rit->col );
-                out_bam->core.l_qseq += it->first.size();
-            }
-            else
-                keep.push_back( make_pair( false, it->first.size() ) );
+    // append an operation, extending the last one if it's the same
+    void push_op( const int op, const int nop )
+    {
+        if ( !cigar.empty() && int( cigar.back() & BAM_CIGAR_MASK ) == op )
+            cigar.back() += nop << BAM_CIGAR_SHIFT;
+        else
+            cigar.push_back( cigval( op, nop ) );
+    }
 
-            ++rit;
-            ++vit;
-        }
-        // matching column in variants, but insertion in read
-        else if ( rit->col == vit->col && rit->op == INS ) {
-            ++vit;
-        }
-        // matching column in read, but insertion in variants:
-        // we got ahead in read somehow, which should never happen
-        else if ( rit->col == vit->col && vit->op == INS ) {
-            cerr << "unknown variant observed, which is weird...( 2 )" << endl;
-            exit( 1 );
-        }
-        // read is behind variants for some reason, which should never happen
-        else if ( rit->col < vit->col ) {
-            cerr << "unknown variant observed, which is weird...( 3 )" << endl;
-            exit( 1 );
+    void push_bases( const bam1_t * const bam, const int idx, const int nop, const bool has_quals )
+    {
+        for ( int i = idx; i < idx + nop; ++i ) {
+            seq.push_back( bam1_seqi( bam1_seq( bam ), i ) );
+            qual.push_back( has_quals ? bam1_qual( bam )[ i ] : 0xFF );
         }
-        else // ( vit->col < rit->col )
-            ++vit;
     }
+};
 
-    // cerr << "seqlen: " << out_bam->core.l_qseq << endl;
-
-    out_bam->data_len = in_bam->data_len;
-    out_bam->m_data = out_bam->data_len;
-    out_bam->data = NULL;
 
-    realloc_data( out_bam );
+// every thread's scratch space, kept across batches rather than rebuilt for each
+inline
+punchout_t & scratch()
+{
+    static thread_local punchout_t ws;
+    return ws;
+}
 
-    // copy the read name
-    memcpy( bam1_qname( out_bam ), bam1_qname( in_bam ), in_bam->core.l_qname );
 
-    // update the cigar string
-    {
-        const uint32_t * cigar = bam1_cigar( in_bam );
-        int in_idx = 0, out_idx = 0;
-        vector< int > cigar_;
-
-        for ( int i = 0; i < in_bam->core.n_cigar; ++i ) {
-            const int op = cigar[ i ] & BAM_CIGAR_MASK;
-            const int nop = cigar[ i ] >> BAM_CIGAR_SHIFT;
-
-            if ( op == BAM_CDEL )
-                for ( int j = 0; j < nop; ++j )
-                    cigar_.push_back( BAM_CDEL );
-            else if ( op == BAM_CINS ) {
-                if ( keep[ in_idx ].second != unsigned( nop ) ) {
-                    cerr << "assumptions violated ( 1 )" << endl;
-                    exit( 1 );
+// copy in_bam into out_bam, turning every base which isn't a "real" variant
+// into a deletion (or, for insertions, dropping it outright) in a single pass
+// over the CIGAR string; returns false if no aligned bases remain
+bool punchout_read(
+        const bam1_t * const in_bam,
+        const keep_t & keep,
+        punchout_t & ws,
+        bam1_t * const out_bam
+        )
+{
+    const uint32_t * const cigar = bam1_cigar( in_bam );
+    const bool has_quals = bam1_qual( in_bam )[ 0 ] != 0xFF;
+    int col = in_bam->core.pos, idx = 0, pos = -1, first = 0, last, n_cigar = 0;
+
+    ws.clear();
+
+    for ( int i = 0; i < in_bam->core.n_cigar; ++i ) {
+        const int op = cigar[ i ] & BAM_CIGAR_MASK;
+        const int nop = cigar[ i ] >> BAM_CIGAR_SHIFT;
+
+        if ( op == BAM_CMATCH || op == BAM_CEQUAL || op == BAM_CDIFF ) {
+            for ( int j = 0; j < nop; ++j, ++col, ++idx ) {
+                if ( keep.keep_match( col, bam1_seqi( bam1_seq( in_bam ), idx ) ) ) {
+                    if ( pos < 0 )
+                        pos = col;
+                    ws.push_op( op, 1 );
+                    ws.push_bases( in_bam, idx, 1, has_quals );
                 }
-                if ( keep[ in_idx ].first )
-                    for ( int j = 0; j < nop; ++j )
-                        cigar_.push_back( op );
                 else
-                    for ( int j = 0; j < nop; ++j )
-                        cigar_.push_back( BAM_CDEL );
-                ++in_idx;
-            }
-            else if ( op == BAM_CMATCH || op == BAM_CEQUAL || op == BAM_CDIFF ) {
-                for ( int j = 0; j < nop; ++j, ++in_idx ) {
-                    if ( keep[ in_idx ].second != 1 ) {
-                        cerr << "assumptions violated ( 2 )" << endl;
-                        exit( 1 );
-                    }
-                    if ( keep[ in_idx ].first )
-                        cigar_.push_back( op );
-                    else
-                        cigar_.push_back( BAM_CDEL );
-                }
+                    ws.push_op( BAM_CDEL, 1 );
             }
         }
+        else if ( op == BAM_CINS ) {
+            ws.elem.clear();
 
-        if ( cigar_.size() ) {
-            int op = cigar_[ 0 ];
-            int nop = 1;
-    
-            for ( unsigned i = 1; i < cigar_.size(); ++i ) {
-                if ( cigar_[ i ] == op )
-                    ++nop;
-                else {
-                    bam1_cigar( out_bam )[ out_idx++ ] = cigval( op, nop );
-                    op = cigar_[ i ];
-                    nop = 1;
-                }
-            
-                if ( out_bam->core.l_qname + out_idx >= out_bam->m_data ) {
-                    ++out_bam->m_data;
-                    realloc_data( out_bam );
-                }
+            for ( int j = idx; j < idx + nop; ++j )
+                ws.elem.push_back( bam1_seqi( bam1_seq( in_bam ), j ) );
+
+            // insertions belong to the column to their left
+            if ( keep.keep_ins( col - 1, &ws.elem[ 0 ], nop ) ) {
+                ws.push_op( op, nop );
+                ws.push_bases( in_bam, idx, nop, has_quals );
             }
 
-            bam1_cigar( out_bam )[ out_idx++ ] = cigval( op, nop );
+            idx += nop;
+        }
+        else if ( op == BAM_CDEL || op == BAM_CREF_SKIP ) {
+            ws.push_op( op, nop );
+            col += nop;
+        }
+        else if ( op == BAM_CSOFT_CLIP ) {
+            ws.push_op( op, nop );
+            ws.push_bases( in_bam, idx, nop, has_quals );
+            idx += nop;
         }
+        else
+            ws.push_op( op, nop );
+    }
+
+    if ( pos < 0 )
+        return false;
 
-        out_bam->core.n_cigar = out_idx;
+    // drop the deletions before the first and after the last aligned base,
+    // as the read now begins at pos
+    for ( ; !is_match( ws.cigar[ first ] ); ++first );
+    for ( last = ws.cigar.size() - 1; !is_match( ws.cigar[ last ] ); --last );
+
+    for ( int i = 0; i < int( ws.cigar.size() ); ++i ) {
+        const int op = ws.cigar[ i ] & BAM_CIGAR_MASK;
+        if ( ( i < first || i > last ) && ( op == BAM_CDEL || op == BAM_CREF_SKIP ) )
+            continue;
+        ws.cigar[ n_cigar++ ] = ws.cigar[ i ];
     }
 
+    out_bam->core = in_bam->core;
+    out_bam->core.pos = pos;
+    out_bam->core.n_cigar = n_cigar;
+    out_bam->core.l_qseq = ws.seq.size();
     out_bam->l_aux = in_bam->l_aux;
-
     out_bam->data_len = (
             out_bam->core.l_qname +
             4 * out_bam->core.n_cigar +
@@ -230,60 +220,28 @@ bam1_t * punchout_read(
             out_bam->l_aux
             );
 
-    out_bam->m_data = out_bam->data_len;
-
-    realloc_data( out_bam );
-
-    memcpy( bam1_aux( out_bam ), bam1_aux( in_bam ), in_bam->l_aux );
+    if ( out_bam->m_data < out_bam->data_len ) {
+        out_bam->m_data = out_bam->data_len;
+        realloc_data( out_bam );
+    }
 
-    // copy the sequence and quality scores
-    {
-        int in_idx = 0, out_idx = 0;
-
-        for ( unsigned i = 0; i < keep.size(); ++i ) {
-            if ( keep[ i ].first )
-                for ( unsigned k = 0; k < keep[ i ].second; ++k ) {
-                    bam1_seq_seti( bam1_seq( out_bam ), out_idx, bam1_seqi( bam1_seq( in_bam ), in_idx ) );
-                    ++in_idx;
-                    ++out_idx;
-            }
-            else
-                in_idx += keep[ i ].second;
-        }
+    memcpy( bam1_qname( out_bam ), bam1_qname( in_bam ), in_bam->core.l_qname );
+    memcpy( bam1_cigar( out_bam ), &ws.cigar[ 0 ], 4 * out_bam->core.n_cigar );
+    memset( bam1_seq( out_bam ), 0, ( out_bam->core.l_qseq + 1 ) / 2 );
 
-        if ( bam1_qual( in_bam )[ 0 ] == 0xFF )
-            bam1_qual( out_bam )[ 0 ] = 0xFF;
-        else {
-            in_idx = 0, out_idx = 0;
+    for ( int i = 0; i < out_bam->core.l_qseq; ++i )
+        bam1_seq_seti( bam1_seq( out_bam ), i, ws.seq[ i ] );
 
-            for ( unsigned i = 0; keep.size(); ++i ) {
-                if ( keep[ i ].first )
-                    for ( unsigned k = 0; k < keep[ i ].second; ++k )
-                        bam1_qual( out_bam )[ out_idx++ ] = bam1_qual( in_bam )[ in_idx++ ];
-                else
-                    in_idx += keep[ i ].second;
-            }
-        }
-    }
+    if ( has_quals )
+        memcpy( bam1_qual( out_bam ), &ws.qual[ 0 ], out_bam->core.l_qseq );
+    else
+        bam1_qual( out_bam )[ 0 ] = 0xFF;
 
-    if ( cols.size() )
-        out_bam->core.pos = cols[ 0 ];
+    memcpy( bam1_aux( out_bam ), bam1_aux( in_bam ), in_bam->l_aux );
 
     out_bam->core.bin = bam_reg2bin( out_bam->core.pos, bam_calend( &out_bam->core, bam1_cigar( out_bam ) ) );
 
-    if ( bam_cigar2qlen( &out_bam->core, bam1_cigar( out_bam ) ) != out_bam->core.l_qseq ) {
-        cerr << "cig2qlen: " << bam_cigar2qlen( &out_bam->core, bam1_cigar( out_bam ) ) << endl;
-        cerr << "l_qseq:   " << out_bam->core.l_qseq << endl;
-        cerr << "invalid CIGAR string for sequence length" << endl;
-        exit( 1 );
-    }
-
-    if ( !bam_validate1( NULL, out_bam ) ) {
-        cerr << "record failed validation" << endl;
-        exit( 1 );
-    }
-
-    return out_bam;
+    return true;
 }
 
 
@@ -291,24 +249,47 @@ int main( int argc, const char * argv[] )
 {
     args_t args = args_t( argc, argv );
     coverage_t coverage;
-    vector< cov_t > variants;
     vector< pair< int, int > > data;
+    int max_cov = 0;
+    // regions, if any, all lie on one reference
+    const int tid = args.bamin->get_regions().empty() ? 0 : args.bamin->get_regions()[ 0 ].tid;
+
+    stats::dump_at_exit( args.stats_json, EXEC );
 
     // accumulate the data at each position in a linked list
     {
+        stats::scope_t scope( stats::PILEUP );
         cov_citer cit;
         bam1_t * in_bam = bam_init1();
+        aligned_t read;
 
-        while ( args.bamin->next( in_bam ) ) {
-            aligned_t read( in_bam );
-            coverage.include( read );
+        if ( args.pileups.empty() )
+            while ( args.bamin->next( in_bam ) ) {
+                read.from_bam( in_bam );
+                coverage.include( read );
+            }
+
+        for ( unsigned i = 0; i < args.pileups.size(); ++i ) {
+            const pileup_t pileup( args.pileups[ i ] );
+            coverage.merge( pileup );
+        }
+
+        if ( args.pileup_out && !coverage.save( args.pileup_out ) ) {
+            cerr << "unable to write pileup to: " << args.pileup_out << endl;
+            exit( 1 );
         }
 
         for ( cit = coverage.begin(); cit != coverage.end(); ++cit ) {
             int cov = 0;
 
+            if ( !args.bamin->in_regions( tid, cit->col ) )
+                continue;
+
             for ( obs_citer it = cit->obs.begin(); it != cit->obs.end(); ++it )
                 cov += it->second;
+
+            if ( cov > max_cov )
+                max_cov = cov;
            
             for ( obs_citer it = cit->obs.begin(); it != cit->obs.end(); ++it )
                 if ( it->second )
@@ -341,16 +322,49 @@ int main( int argc, const char * argv[] )
     {
         cov_iter cit;
         double lg_L, aicc, bg, lg_bg, lg_invbg;
-        rateclass_t rc( data );
+        const double lg_cutoff = log( args.cutoff );
         vector< pair< double, double > > params;
+        stats::scope_t fit( stats::FIT );
+        FILE * model = args.model ? fopen( args.model, "r" ) : NULL;
+
+        // reuse a previously fitted model, if we have one
+        if ( model ) {
+            if ( !params_json_load( model, "puncher", lg_L, aicc, params, bg ) || params.empty() || !bg ) {
+                cerr << "unable to read model from: " << args.model << endl;
+                exit( 1 );
+            }
+
+            fclose( model );
+        }
+        else {
+            rateclass_t rc( data );
+
+            rc( lg_L, aicc, params );
 
-        rc( lg_L, aicc, params );
+            // the background is the lowest rate class
+            bg = params[ 0 ].second;
+
+            if ( args.model ) {
+                if ( !( model = fopen( args.model, "w" ) ) ) {
+                    cerr << "unable to write model to: " << args.model << endl;
+                    exit( 1 );
+                }
+
+                params_json_dump( model, lg_L, aicc, params, bg, 17, "puncher" );
+                fclose( model );
+            }
+        }
 
-        bg = params[ 0 ].second;
         lg_bg = log( bg );
         lg_invbg = log( 1.0 - bg );
 
-        params_json_dump( stderr, lg_L, aicc, params );
+        params_json_dump( stderr, lg_L, aicc, params, bg );
+
+        lg_factorial_reserve( max_cov );
+
+        fit.stop();
+
+        stats::scope_t call( stats::CALL );
 
         // cerr << "background: " << bg << endl;
 
@@ -359,36 +373,52 @@ int main( int argc, const char * argv[] )
             if ( cit->op == INS )
                 continue;
 
+            // leave everything outside of our regions untouched
+            if ( !args.bamin->in_regions( tid, cit->col ) ) {
+                for ( obs_iter it = cit->obs.begin(); it != cit->obs.end(); ++it )
+                    it->second = 1;
+                continue;
+            }
+
             int cov = 0;
 
             for ( obs_citer it = cit->obs.begin(); it != cit->obs.end(); ++it )
                 cov += it->second;
 
             for ( obs_iter it = cit->obs.begin(); it != cit->obs.end(); ++it ) {
-                const double p = prob_background( lg_bg, lg_invbg, cov, it->second );
-                if ( p < args.cutoff ) {
+                const double lg_p = lg_prob_background( lg_bg, lg_invbg, cov, it->second );
+                if ( lg_p < lg_cutoff ) {
                     cout << cit->col << "\t" << cov << "\t" << it->second;
                     for ( unsigned i = 0; i < it->first.size(); ++i )
                         cout << bits2nuc( it->first[ i ] );
-                    cout << ":" << p << endl;
+                    cout << ":" << exp( lg_p ) << endl;
                     it->second = 1;
                 }
                 else {
                     it->second = 0;
                 }
             }
-
-#if 0
-            variants.push_back( *cit );
-#endif
         }
     }
 
-    return 0;
-
-    // write out the input reads, but only with "real" variants this time
+    // write out the input reads, but only with "real" variants this time:
+    // read a batch, punch it out in parallel, then write it out in order
     {
-        bam1_t * const in_bam = bam_init1();
+        vector< bam1_t * > in_bams( PUNCHOUT_BATCH ), out_bams( PUNCHOUT_BATCH );
+        vector< char > kept( PUNCHOUT_BATCH );
+        stats::scope_t scope( stats::WRITE );
+        const keep_t keep( coverage );
+        int nread = PUNCHOUT_BATCH;
+
+        for ( int i = 0; i < PUNCHOUT_BATCH; ++i ) {
+            in_bams[ i ] = bam_init1();
+            out_bams[ i ] = bam_init1();
+
+            if ( !in_bams[ i ] || !out_bams[ i ] ) {
+                cerr << "memory allocation error" << endl;
+                exit( 1 );
+            }
+        }
 
         if ( !args.bamin->seek0() ) {
             cerr << "unable to seek( 0 )" << endl;
@@ -400,23 +430,37 @@ int main( int argc, const char * argv[] )
             exit( 1 );
         }
 
-        while ( args.bamin->next( in_bam ) ) {
-            aligned_t read( in_bam );
+        while ( nread == PUNCHOUT_BATCH ) {
+            stats::scope_t decode( stats::DECODE );
 
-            bam1_t * const out_bam = punchout_read( in_bam, variants, read );
+            for ( nread = 0; nread < PUNCHOUT_BATCH && args.bamin->next( in_bams[ nread ] ); ++nread );
 
-            if ( !out_bam->core.l_qseq )
-                continue;
+            decode.stop();
 
-            if ( !args.bamout->write( out_bam ) ) {
-                cerr << "error writing out read" << endl;
-                exit( 1 );
+            #pragma omp parallel
+            {
+                punchout_t & ws = scratch();
+
+                #pragma omp for schedule( dynamic, 64 )
+                for ( int i = 0; i < nread; ++i )
+                    kept[ i ] = punchout_read( in_bams[ i ], keep, ws, out_bams[ i ] );
             }
 
-            bam_destroy1( out_bam );
+            for ( int i = 0; i < nread; ++i ) {
+                if ( !kept[ i ] )
+                    continue;
+
+                if ( !args.bamout->write( out_bams[ i ] ) ) {
+                    cerr << "error writing out read" << endl;
+                    exit( 1 );
+                }
+            }
         }
 
-        bam_destroy1( in_bam );
+        for ( int i = 0; i < PUNCHOUT_BATCH; ++i ) {
+            bam_destroy1( out_bams[ i ] );
+            bam_destroy1( in_bams[ i ] );
+        }
     }
 
     return 0;
@@ -4,11 +4,18 @@
 #include <cstdlib>
 #include <cstdio>
 #include <iostream>
+#include <string>
 #include <utility>
 #include <vector>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "dispatch.hpp"
 #include "math.hpp"
 #include "rateclass.hpp"
+#include "stats.hpp"
 #include "util.hpp"
 
 
@@ -19,9 +26,11 @@ using std::log;
 using std::make_pair;
 using std::pair;
 using std::sort;
+using std::string;
 using std::vector;
 
 using math::lg_choose;
+using math::lg_factorial_reserve;
 using util::triple;
 
 
@@ -32,18 +41,23 @@ namespace rateclass
             const double lg_L,
             const double aicc,
             const vector< pair< double, double > > & params,
-            const double bg
+            const double bg,
+            const int precision,
+            const char * const kind
             )
     {
-        if ( bg ) {
+        if ( kind )
+            fprintf( file, "{\n  \"kind\":     \"%s\",\n", kind );
+        else
             fprintf( file, "{\n" );
+
+        if ( bg ) {
             fprintf( file, "  \"logl\":     % .3f,\n", lg_L );
             fprintf( file, "  \"aicc\":     % .3f,\n", aicc );
-            fprintf( file, "  \"bg\":       % .7f,\n", bg );
+            fprintf( file, "  \"bg\":       % .*f,\n", precision, bg );
             fprintf( file, "  \"rates\":   [ " );
         }
         else {
-            fprintf( file, "{\n" );
             fprintf( file, "  \"logl\":     % .3f,\n", lg_L );
             fprintf( file, "  \"aicc\":     % .3f,\n", aicc );
             fprintf( file, "  \"rates\":   [ " );
@@ -51,18 +65,18 @@ namespace rateclass
 
         for ( unsigned i = 0; i < params.size(); ++i ) {
             if ( i > 0 )
-                fprintf( file, ", %.7f", params[ i ].second );
+                fprintf( file, ", %.*f", precision, params[ i ].second );
             else
-                fprintf( file, "%.7f", params[ i ].second );
+                fprintf( file, "%.*f", precision, params[ i ].second );
         }
 
         fprintf( file, " ],\n  \"weights\": [ " );
 
         for ( unsigned i = 0; i < params.size(); ++i ) {
             if ( i > 0 )
-                fprintf( file, ", %.7f", params[ i ].first );
+                fprintf( file, ", %.*f", precision, params[ i ].first );
             else
-                fprintf( file, "%.7f", params[ i ].first );
+                fprintf( file, "%.*f", precision, params[ i ].first );
         }
 
         fprintf( file, " ]\n}\n" );
@@ -70,6 +84,114 @@ namespace rateclass
     }
 
 
+    // find "key": in str and parse the number following it
+    bool json_number( const string & str, const char * key, double & value )
+    {
+        const size_t pos = str.find( string( "\"" ) + key + "\"" );
+        char * end;
+
+        if ( pos == string::npos || str.find( ':', pos ) == string::npos )
+            return false;
+
+        const char * const begin = str.c_str() + str.find( ':', pos ) + 1;
+
+        value = strtod( begin, &end );
+
+        return end != begin;
+    }
+
+
+    // find "key": in str and take the string following it, without escapes
+    bool json_string( const string & str, const char * key, string & value )
+    {
+        const size_t pos = str.find( string( "\"" ) + key + "\"" );
+        size_t begin, end;
+
+        if ( pos == string::npos || ( begin = str.find( '"', str.find( ':', pos ) ) ) == string::npos )
+            return false;
+
+        if ( ( end = str.find( '"', ++begin ) ) == string::npos )
+            return false;
+
+        value = str.substr( begin, end - begin );
+
+        return true;
+    }
+
+
+    // find "key": in str and parse the array of numbers following it
+    bool json_array( const string & str, const char * key, vector< double > & values )
+    {
+        const size_t pos = str.find( string( "\"" ) + key + "\"" );
+        const char * p;
+
+        values.clear();
+
+        if ( pos == string::npos || str.find( '[', pos ) == string::npos )
+            return false;
+
+        for ( p = str.c_str() + str.find( '[', pos ) + 1; ; ) {
+            char * end;
+            const double value = strtod( p, &end );
+
+            if ( end == p )
+                break;
+
+            values.push_back( value );
+
+            for ( p = end; *p == ' ' || *p == '\n' || *p == '\t'; ++p );
+
+            if ( *p != ',' )
+                break;
+
+            ++p;
+        }
+
+        return !values.empty();
+    }
+
+
+    // a model must name its kind and background, as both tools write them
+    bool params_json_load(
+            FILE * const file,
+            const char * const kind,
+            double & lg_L,
+            double & aicc,
+            vector< pair< double, double > > & params,
+            double & bg
+            )
+    {
+        vector< double > rates, weights;
+        string str, found;
+        char buf[ 4096 ];
+        size_t n;
+
+        while ( ( n = fread( buf, sizeof( char ), sizeof( buf ), file ) ) )
+            str.append( buf, n );
+
+        if ( !json_number( str, "logl", lg_L ) ||
+                !json_number( str, "aicc", aicc ) ||
+                !json_array( str, "rates", rates ) ||
+                !json_array( str, "weights", weights ) ||
+                !json_number( str, "bg", bg ) ||
+                !json_string( str, "kind", found ) ||
+                rates.size() != weights.size() )
+            return false;
+
+        if ( found != kind ) {
+            cerr << "the model was fitted by " << found << ", not " << kind << endl;
+            return false;
+        }
+
+        params.clear();
+
+        for ( unsigned i = 0; i < rates.size(); ++i )
+            params.push_back( make_pair( weights[ i ], rates[ i ] ) );
+
+        return true;
+    }
+
+
     inline
     double lg_binomial(
             const int cov,
@@ -83,11 +205,45 @@ namespace rateclass
     }
 
 
+    // fill row with the posterior of every class given ( cov, maj ),
+    // and return the log of its likelihood; buf must hold nparam doubles
+    HOT_KERNEL
+    double lg_posterior(
+            const int cov,
+            const int maj,
+            const triple< double, double, double > * const lg_params,
+            const int nparam,
+            double * const buf,
+            double * const row
+            )
+    {
+        double max = lg_binomial( cov, maj, lg_params[ 0 ] );
+        double sum = 0.0;
+
+        buf[ 0 ] = max;
+
+        for ( int j = 1; j < nparam; ++j ) {
+            buf[ j ] = lg_binomial( cov, maj, lg_params[ j ] );
+            if ( buf[ j ] > max )
+                max = buf[ j ];
+        }
+
+        for ( int j = 0; j < nparam; ++j ) {
+            buf[ j ] = exp( buf[ j ] - max );
+            sum += buf[ j ];
+        }
+
+        for ( int j = 0; j < nparam; ++j )
+            row[ j ] = buf[ j ] / sum;
+
+        return log( sum ) + max;
+    }
+
+
     double lg_likelihood(
             double * const pij,
             const vector< pair< int, int > > & data, // [ ( coverage, majority ) ]
-            const vector< pair< double, double > > & params, // [ ( weight, rate ) ]
-            bool include_constant = false
+            const vector< pair< double, double > > & params // [ ( weight, rate ) ]
             )
     {
         triple< double, double, double > * const _lg_params = \
@@ -103,35 +259,21 @@ namespace rateclass
 
         const triple< double, double, double > * const lg_params = _lg_params;
 
-        #pragma omp parallel for reduction( + : lg_L )
-        for ( int i = 0; i < int( data.size() ); ++i ) {
-            const int cov = data[ i ].first, maj = data[ i ].second;
-            double * buf = new double[ params.size() ];
-            double max = lg_binomial( cov, maj, lg_params[ 0 ] );
-            double sum = 0.0;
-
-            buf[ 0 ] = max;
-
-            for ( unsigned j = 1; j < params.size(); ++j ) {
-                buf[ j ] = lg_binomial( cov, maj, lg_params[ j ] );
-                if ( buf[ j ] > max )
-                    max = buf[ j ];
-            }
-
-            for ( unsigned j = 0; j < params.size(); ++j ) {
-                buf[ j ] = exp( buf[ j ] - max );
-                sum += buf[ j ];
-            }
-
-            for ( unsigned j = 0; j < params.size(); ++j )
-                pij[ i * params.size() + j ] = buf[ j ] / sum;
-
-            lg_L += log( sum ) + max;
-
-            if ( include_constant )
-                lg_L += lg_choose( cov, maj );
-        
-            delete [] buf;
+        #pragma omp parallel
+        {
+            // one buffer per thread, rather than one per datum
+            vector< double > buf( params.size() );
+
+            #pragma omp for reduction( + : lg_L )
+            for ( int i = 0; i < int( data.size() ); ++i )
+                lg_L += lg_posterior(
+                    data[ i ].first,
+                    data[ i ].second,
+                    lg_params,
+                    params.size(),
+                    &buf[ 0 ],
+                    pij + i * params.size()
+                    );
         }
 
         delete [] _lg_params;
@@ -140,41 +282,51 @@ namespace rateclass
     }
 
 
+    // accumulate the sums of every class a row of pij at a time, in the
+    // order pij is laid out, which vectorizes across classes; each class
+    // still sums its data in the same order, so the results are unchanged
+    HOT_KERNEL
     void update_params(
             const double * const pij,
             const vector< pair< int, int > > & data, // [ ( coverage, majority ) ]
             vector< pair< double, double > > & params // [ ( weight, rate ) ]
             )
     {
-        for ( unsigned i = 0; i < params.size(); ++i ) {
-            double sum = 0.0, sum_cov = 0.0, sum_maj = 0.0;
-
-            for ( unsigned j = 0; j < data.size(); ++j ) {
-                double p = pij[ j * params.size() + i ];
-                sum += p;
-                sum_cov += p * data[ j ].first;
-                sum_maj += p * data[ j ].second;
+        const unsigned nparam = params.size();
+        vector< double > sums( 3 * nparam, 0.0 );
+        double * const sum = &sums[ 0 ];
+        double * const sum_cov = sum + nparam;
+        double * const sum_maj = sum_cov + nparam;
+
+        for ( unsigned j = 0; j < data.size(); ++j ) {
+            const double * const p = pij + j * nparam;
+            const double cov = data[ j ].first, maj = data[ j ].second;
+
+            for ( unsigned i = 0; i < nparam; ++i ) {
+                sum[ i ] += p[ i ];
+                sum_cov[ i ] += p[ i ] * cov;
+                sum_maj[ i ] += p[ i ] * maj;
             }
+        }
 
-            params[ i ].first = sum / data.size();
+        for ( unsigned i = 0; i < nparam; ++i ) {
+            params[ i ].first = sum[ i ] / data.size();
 
-            if ( sum_cov == 0.0 )
+            if ( sum_cov[ i ] == 0.0 )
                 params[ i ].second = 1.0;
             else
-                params[ i ].second = sum_maj / sum_cov;
+                params[ i ].second = sum_maj[ i ] / sum_cov[ i ];
         }
     }
 
 
-    void initialize_params( vector< pair< double, double > > & params, const int iter )
+    void initialize_params( vector< pair< double, double > > & params, unsigned & state )
     {
         double sum = 0.0;
 
         for ( unsigned i = 0; i < params.size(); ++i ) {
-            if ( iter >= 10 || i >= params.size() - 1 ) {
-                params[ i ].first = rand() / double( RAND_MAX );
-                params[ i ].second = rand() / double( RAND_MAX );
-            }
+            params[ i ].first = rand_r( &state ) / double( RAND_MAX );
+            params[ i ].second = rand_r( &state ) / double( RAND_MAX );
             sum += params[ i ].first;
         }
 
@@ -183,14 +335,110 @@ namespace rateclass
     }
 
 
+    // nudge a rate up or down in logit space, so it always stays within ( 0, 1 )
+    inline
+    double perturb_rate( const double rate, const double delta )
+    {
+        const double r = ( rate < 1e-6 ) ? 1e-6 : ( rate > 1.0 - 1e-6 ) ? 1.0 - 1e-6 : rate;
+        return 1.0 / ( 1.0 + exp( -( log( r / ( 1.0 - r ) ) + delta ) ) );
+    }
+
+
+    // split class idx of params into two classes with half the weight each
+    // and rates on either side of the original
+    void split_params(
+            const vector< pair< double, double > > & params,
+            const unsigned idx,
+            vector< pair< double, double > > & split
+            )
+    {
+        split.clear();
+
+        for ( unsigned i = 0; i < params.size(); ++i ) {
+            if ( i == idx ) {
+                split.push_back( make_pair( 0.5 * params[ i ].first, perturb_rate( params[ i ].second, -1.0 ) ) );
+                split.push_back( make_pair( 0.5 * params[ i ].first, perturb_rate( params[ i ].second, 1.0 ) ) );
+            }
+            else
+                split.push_back( params[ i ] );
+        }
+    }
+
+
+    // merge classes idx and idx + 1 of params (sorted by rate) into one
+    void merge_params(
+            const vector< pair< double, double > > & params,
+            const unsigned idx,
+            vector< pair< double, double > > & merged
+            )
+    {
+        merged.clear();
+
+        for ( unsigned i = 0; i < params.size(); ++i ) {
+            if ( i == idx ) {
+                const double w = params[ i ].first + params[ i + 1 ].first;
+                const double r = ( w > 0.0 ) ?
+                    ( params[ i ].first * params[ i ].second + params[ i + 1 ].first * params[ i + 1 ].second ) / w :
+                    0.5 * ( params[ i ].second + params[ i + 1 ].second );
+                merged.push_back( make_pair( w, r ) );
+                ++i;
+            }
+            else
+                merged.push_back( params[ i ] );
+        }
+    }
+
+
+    // merge classes idx and idx + 1 of params (sorted by rate),
+    // and split the heaviest remaining class to keep the number of classes fixed
+    void split_merge_params(
+            const vector< pair< double, double > > & params,
+            const unsigned idx,
+            vector< pair< double, double > > & smem
+            )
+    {
+        vector< pair< double, double > > merged;
+        unsigned heaviest = 0;
+
+        merge_params( params, idx, merged );
+
+        for ( unsigned i = 1; i < merged.size(); ++i )
+            if ( i != idx && ( heaviest == idx || merged[ i ].first > merged[ heaviest ].first ) )
+                heaviest = i;
+
+        split_params( merged, heaviest, smem );
+    }
+
+
+    // the part of the log-likelihood which doesn't depend upon the parameters
+    double lg_constant( const vector< pair< int, int > > & data )
+    {
+        double rv = 0.0;
+
+        for ( unsigned i = 0; i < data.size(); ++i )
+            rv += lg_choose( data[ i ].first, data[ i ].second );
+
+        return rv;
+    }
+
+
+    // run EM to convergence (or at most 100 iterations), returning the log-likelihood
+    // without the binomial constant. Every iteration is charged to budget, and
+    // the run is abandoned early once even extrapolating the current improvement
+    // over the remaining iterations can't reach lg_bound
     double EM(
             const vector< pair< int, int > > & data, // [ ( coverage, majority ) ]
-            vector< pair< double, double > > & params // [ ( weight, rate ) ]
+            vector< pair< double, double > > & params, // [ ( weight, rate ) ]
+            int & budget,
+            const double lg_bound = -HUGE_VAL
             )
     {
+        const long nbytes = data.size() * params.size() * sizeof( double );
         double * pij = new double[ data.size() * params.size() ];
         double lg_L;
 
+        stats::track( stats::EM, nbytes );
+
         if ( params.size() == 1 ) {
             int sum_cov = 0, sum_maj = 0;
 
@@ -205,27 +453,37 @@ namespace rateclass
                 params[ 0 ].second = 1.0;
             else
                 params[ 0 ].second = double( sum_maj ) / double( sum_cov ); // or inverse of this?
+
+            lg_L = lg_likelihood( pij, data, params );
         }
         else {
             lg_L = lg_likelihood( pij, data, params );
 
-            for( int i = 0; i < 100; ++i ) {
+            for ( int i = 0; i < 100 && budget > 0; ++i, --budget ) {
                 double new_lg_L;
 
                 update_params( pij, data, params );
                 new_lg_L = lg_likelihood( pij, data, params );
 
-                if ( fabs( lg_L - new_lg_L ) < 1e-8 )
+                if ( fabs( lg_L - new_lg_L ) < 1e-8 ) {
+                    lg_L = new_lg_L;
                     break;
+                }
+
+                // clearly worse than the incumbent, so give up
+                if ( new_lg_L + ( new_lg_L - lg_L ) * ( 99 - i ) < lg_bound ) {
+                    lg_L = new_lg_L;
+                    break;
+                }
 
                 lg_L = new_lg_L;
             }
         }
 
-        lg_L = lg_likelihood( pij, data, params, true );
-
         delete [] pij;
 
+        stats::track( stats::EM, -nbytes );
+
         return lg_L;
     }
 
@@ -236,48 +494,103 @@ namespace rateclass
     }
 
 
-    rateclass_t::rateclass_t( const vector< pair< int, int > > & data, const int factor ) :
+    rateclass_t::rateclass_t(
+            const vector< pair< int, int > > & data,
+            const int factor,
+            const unsigned seed
+            ) :
         data( data ),
-        factor( factor )
+        factor( factor ),
+        seed( seed )
     {
+        int max_cov = 0;
+
+        for ( unsigned i = 0; i < data.size(); ++i )
+            if ( data[ i ].first > max_cov )
+                max_cov = data[ i ].first;
+
+        // growing the table isn't thread-safe, and past its end lg_factorial
+        // falls back on lgamma, which costs a fit next to nothing
+#ifdef _OPENMP
+        if ( !omp_in_parallel() )
+#endif
+            lg_factorial_reserve( max_cov );
     }
 
 
+    // order classes by rate; strictly, as sort requires
     bool rate_cmp( const pair< double, double > & a, const pair< double, double > & b )
     {
-        if ( a.second <= b.second )
-            return true;
-        return false;
+        return a.second < b.second;
     }
 
 
-    void rateclass_t::operator()(
+    // the number of free parameters of a model with k classes
+    inline
+    int nparam( const int k )
+    {
+        return ( k == 1 ) ? 1 : 2 * k;
+    }
+
+
+    // add classes to params, one at a time, for as long as AICc improves
+    void rateclass_t::grow(
             double & lg_L,
             double & aicc,
             vector< pair< double, double > > & params,
-            const int nrestart
+            int & budget,
+            const int nrestart,
+            const double lg_C,
+            unsigned & state
             ) const
     {
-        params.clear();
-        params.push_back( make_pair( 1.0, 0.5 ) );
-        lg_L = EM( data, params );
-        aicc = _aicc( 1, lg_L, data.size() / factor );
+        for ( int i = params.size() + 1; budget > 0; ++i ) {
+            double old_lg_L = -HUGE_VAL, old_aicc;
+            vector< pair< double, double > > old_params;
+            int nstart = 0;
+
+            // warm start: split each class of the previous optimum in two
+            for ( unsigned j = 0; j < params.size() && budget > 0; ++j, ++nstart ) {
+                double new_lg_L;
+                vector< pair< double, double > > new_params;
+
+                split_params( params, j, new_params );
+                new_lg_L = EM( data, new_params, budget, old_lg_L );
+
+                if ( new_lg_L > old_lg_L ) {
+                    old_lg_L = new_lg_L;
+                    old_params = new_params;
+                }
+            }
+
+            // escape local optima: merge two neighbouring classes of the incumbent
+            // and split another, keeping the number of classes the same
+            if ( i > 2 ) {
+                vector< pair< double, double > > best_params = old_params;
 
-        for ( int i = 2; ; ++i ) {
-            double old_lg_L, old_aicc;
-            vector< pair< double, double > > old_params = params;
+                sort( best_params.begin(), best_params.end(), rate_cmp );
 
-            old_params.push_back( make_pair( 1.0, 0.5 ) );
+                for ( unsigned j = 0; j + 1 < best_params.size() && budget > 0; ++j, ++nstart ) {
+                    double new_lg_L;
+                    vector< pair< double, double > > new_params;
 
-            initialize_params( old_params, 0 );
-            old_lg_L = EM( data, old_params );
+                    split_merge_params( best_params, j, new_params );
+                    new_lg_L = EM( data, new_params, budget, old_lg_L );
 
-            for ( int j = 1; j < nrestart; ++j ) {
+                    if ( new_lg_L > old_lg_L ) {
+                        old_lg_L = new_lg_L;
+                        old_params = new_params;
+                    }
+                }
+            }
+
+            // fill up the remaining restarts with random initializations
+            for ( ; nstart < nrestart && budget > 0; ++nstart ) {
                 double new_lg_L;
-                vector< pair< double, double > > new_params = old_params;
+                vector< pair< double, double > > new_params( i );
 
-                initialize_params( new_params, j );
-                new_lg_L = EM( data, new_params );
+                initialize_params( new_params, state );
+                new_lg_L = EM( data, new_params, budget, old_lg_L );
 
                 if ( new_lg_L > old_lg_L ) {
                     old_lg_L = new_lg_L;
@@ -285,7 +598,8 @@ namespace rateclass
                 }
             }
 
-            old_aicc = _aicc( 2 * i, old_lg_L, data.size() / factor );
+            old_lg_L += lg_C;
+            old_aicc = _aicc( nparam( i ), old_lg_L, data.size() / factor );
 
             // if our AICc doesn't improve, we're done
             if ( old_aicc >= aicc )
@@ -295,12 +609,120 @@ namespace rateclass
             lg_L = old_lg_L;
             params = old_params;
         }
+    }
+
 
-        // we've actually rates corresponding to the majority,
-        // but we really want the inverse
+    // we've actually rates corresponding to the majority,
+    // but we really want the inverse
+    void invert_rates( vector< pair< double, double > > & params )
+    {
         for ( unsigned i = 0; i < params.size(); ++i )
             params[ i ].second = 1.0 - params[ i ].second;
+    }
+
+
+    // maxiter is a cap on running time, not a guarantee of convergence:
+    // if the search spent it all, say so, for it stopped where it was
+    void warn_budget( const int budget, const int maxiter )
+    {
+        if ( budget <= 0 )
+            cerr << "warning: model selection stopped after " << maxiter
+                 << " EM iterations, and may have found too few rate classes" << endl;
+    }
+
+
+    // select the number of rate classes by AICc, spending at most maxiter EM
+    // iterations in all; when that runs out, the best model found so far is
+    // returned as is, with a warning
+    void rateclass_t::operator()(
+            double & lg_L,
+            double & aicc,
+            vector< pair< double, double > > & params,
+            const int nrestart,
+            const int maxiter
+            ) const
+    {
+        const double lg_C = lg_constant( data );
+        int budget = maxiter;
+        unsigned state = seed;
+
+        params.clear();
+        params.push_back( make_pair( 1.0, 0.5 ) );
+        lg_L = EM( data, params, budget ) + lg_C;
+        aicc = _aicc( nparam( 1 ), lg_L, data.size() / factor );
+
+        grow( lg_L, aicc, params, budget, nrestart, lg_C, state );
+        warn_budget( budget, maxiter );
+
+        invert_rates( params );
+        sort( params.begin(), params.end(), rate_cmp );
+    }
+
+
+    // refit starting from a previous model (as returned by operator()),
+    // e.g. after more data has arrived: re-converge the previous classes,
+    // drop classes by merging neighbours while AICc improves, and otherwise
+    // try adding classes as operator() would
+    void rateclass_t::refit(
+            double & lg_L,
+            double & aicc,
+            vector< pair< double, double > > & params,
+            const int nrestart,
+            const int maxiter
+            ) const
+    {
+        const double lg_C = lg_constant( data );
+        int budget = maxiter;
+        unsigned state = seed;
+        bool shrunk = false;
+
+        if ( params.empty() ) {
+            ( *this )( lg_L, aicc, params, nrestart, maxiter );
+            return;
+        }
+
+        invert_rates( params );
+        sort( params.begin(), params.end(), rate_cmp );
+
+        lg_L = EM( data, params, budget ) + lg_C;
+        aicc = _aicc( nparam( params.size() ), lg_L, data.size() / factor );
+
+        while ( params.size() > 1 && budget > 0 ) {
+            double new_lg_L = -HUGE_VAL, new_aicc;
+            vector< pair< double, double > > new_params;
+
+            for ( unsigned j = 0; j + 1 < params.size() && budget > 0; ++j ) {
+                double merged_lg_L;
+                vector< pair< double, double > > merged;
+
+                merge_params( params, j, merged );
+                merged_lg_L = EM( data, merged, budget, new_lg_L );
+
+                if ( merged_lg_L > new_lg_L ) {
+                    new_lg_L = merged_lg_L;
+                    new_params = merged;
+                }
+            }
+
+            new_lg_L += lg_C;
+            new_aicc = _aicc( nparam( new_params.size() ), new_lg_L, data.size() / factor );
+
+            if ( new_aicc >= aicc )
+                break;
+
+            aicc = new_aicc;
+            lg_L = new_lg_L;
+            params = new_params;
+            sort( params.begin(), params.end(), rate_cmp );
+            shrunk = true;
+        }
+
+        if ( !shrunk )
+            grow( lg_L, aicc, params, budget, nrestart, lg_C, state );
+
+        warn_budget( budget, maxiter );
 
+        invert_rates( params );
         sort( params.begin(), params.end(), rate_cmp );
     }
 }
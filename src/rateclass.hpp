@@ -1,4 +1,5 @@
 
+#include <cstdio>
 #include <utility>
 #include <vector>
 
@@ -12,7 +13,22 @@ namespace rateclass
             const double lg_L,
             const double aicc,
             const std::vector< std::pair< double, double > > & params,
-            const double bg = 0.0
+            const double bg = 0.0,
+            const int precision = 7,
+            const char * const kind = NULL
+            );
+
+    // read back a model written by params_json_dump, which must be of the
+    // given kind (the tool that fitted it, as each derives its background
+    // differently); false if it lacks its kind or background, and with a
+    // complaint on stderr if the kind is wrong
+    bool params_json_load(
+            FILE * const file,
+            const char * const kind,
+            double & lg_L,
+            double & aicc,
+            std::vector< std::pair< double, double > > & params,
+            double & bg
             );
 
     class rateclass_t
@@ -20,14 +36,40 @@ namespace rateclass
     private:
         const std::vector< std::pair< int, int > > & data;
         const int factor;
+        const unsigned seed;
+
+        void grow(
+            double & lg_L,
+            double & aicc,
+            std::vector< std::pair< double, double > > & params,
+            int & budget,
+            const int nrestart,
+            const double lg_C,
+            unsigned & state
+            ) const;
 
     public:
-        rateclass_t( const std::vector< std::pair< int, int > > & data, const int factor = 1 );
+        // random restarts draw from their own generator, seeded with seed
+        // afresh by every fit, so that fits running side by side in
+        // separate threads give the same models as they would one by one
+        rateclass_t(
+            const std::vector< std::pair< int, int > > & data,
+            const int factor = 1,
+            const unsigned seed = 1
+            );
         void operator()(
             double & lg_L,
             double & aicc,
             std::vector< std::pair< double, double > > & params,
-            const int nrestart = 50
+            const int nrestart = 50,
+            const int maxiter = 10000
+            ) const;
+        void refit(
+            double & lg_L,
+            double & aicc,
+            std::vector< std::pair< double, double > > & params,
+            const int nrestart = 50,
+            const int maxiter = 10000
             ) const;
     };
 }
@@ -5,6 +5,8 @@
 #include <cstdlib>
 #include <cstring>
 
+#include "bam.h"
+
 #include "args.hpp"
 
 
@@ -18,12 +20,15 @@ using bamfile::bamfile_t;
 #define TO_STR(x) STRIFY(x)
 
 const char usage[] =
-    "usage: " EXEC " [-h] "
+    "usage: " EXEC " [-h] [--stats-json PATH] "
     "[-b BEGIN] "
     "[-e END] "
+    "[-o MIN_OVERLAP] "
     "[-r MIN_READS] "
     "[-s STRIDE] "
+    "[-t REFERENCE] "
     "[-w WINDOW_SIZE] "
+    "[-g] [-a] "
     "(-B BAM_IN BAM_OUT)\n";
 
 const char help_msg[] =
@@ -34,14 +39,22 @@ const char help_msg[] =
     "\n"
     "optional arguments:\n"
     "  -h, --help               show this help message and exit\n"
+    "  --stats-json PATH        write per-stage timings and counters to PATH as JSON on exit\n"
     "  -b BEGIN                 begin at position BEGIN in reference\n"
     "  -e END                   end at position END in reference\n"
+    "  -o MIN_OVERLAP           minimum overlap between two reads to merge them (default="
+                                TO_STR( DEFAULT_MIN_OVERLAP ) ")\n"
     "  -r MIN_READS             minimum number of contributing reads to report a sample (default="
                                 TO_STR( DEFAULT_MIN_READS ) ")\n"
     "  -s STRIDE                walk by STRIDE positions at a time (default="
-                                TO_STR( DEFAULT_STRIDE ) ")\n"                
+                                TO_STR( DEFAULT_STRIDE ) ")\n"
+    "  -t REFERENCE             sample windows of REFERENCE (default=the first reference)\n"
     "  -w WINDOW_SIZE           use windows of size WINDOW_SIZE (default="
-                                TO_STR( DEFAULT_WINDOW_SIZE ) ")\n";
+                                TO_STR( DEFAULT_WINDOW_SIZE ) ")\n"
+    "  -g                       don't tolerate gaps\n"
+    "  -a                       don't tolerate ambigs\n"
+    "\n"
+    "BAM_IN must be indexed\n";
 
 inline
 void help()
@@ -63,13 +76,16 @@ args_t::args_t( int argc, const char * argv[] ) :
     bamout( NULL ),
     min_overlap( DEFAULT_MIN_OVERLAP ),
     min_reads( DEFAULT_MIN_READS ),
+    tid( 0 ),
     begin( DEFAULT_BEGIN ),
     end( DEFAULT_END ),
     window_size( DEFAULT_WINDOW_SIZE ),
     stride( DEFAULT_STRIDE ),
     tol_gaps( DEFAULT_TOL_GAPS ),
-    tol_ambigs( DEFAULT_TOL_AMBIGS )
+    tol_ambigs( DEFAULT_TOL_AMBIGS ),
+    stats_json( NULL )
 {
+    const char * reference = NULL;
     int i;
 
     // skip arg[0], it's just the program name
@@ -78,6 +94,7 @@ args_t::args_t( int argc, const char * argv[] ) :
 
         if ( arg[0] == '-' && arg[1] == '-' ) {
             if ( !strcmp( &arg[2], "help" ) ) help();
+            else if ( !strcmp( &arg[2], "stats-json" ) ) parse_statsjson( argv[++i] );
 #if 0
             else if ( !strcmp( &arg[2], "fasta" ) ) parse_fasta( argv[++i] );
             else if ( !strcmp( &arg[2], "fastq" ) ) parse_fastq( argv[++i] );
@@ -95,9 +112,13 @@ args_t::args_t( int argc, const char * argv[] ) :
             }
             else if ( !strcmp( &arg[1], "b" ) ) parse_begin( argv[ ++i ] );
             else if ( !strcmp( &arg[1], "e" ) ) parse_end( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "o" ) ) parse_minoverlap( argv[++i] );
             else if ( !strcmp( &arg[1], "r" ) ) parse_minreads( argv[++i] );
             else if ( !strcmp( &arg[1], "s" ) ) parse_stride( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "t" ) ) reference = argv[ ++i ];
             else if ( !strcmp( &arg[1], "w" ) ) parse_windowsize( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "g" ) ) parse_tolgaps();
+            else if ( !strcmp( &arg[1], "a" ) ) parse_tolambigs();
             else
                 ERROR( "unknown argument: %s", arg );
         }
@@ -108,12 +129,18 @@ args_t::args_t( int argc, const char * argv[] ) :
     if ( !bamin || !bamout )
         ERROR( "missing required argument -B BAM_IN BAM_OUT" );
 
+    if ( reference )
+        parse_reference( reference );
+
     if ( !end ) {
         if ( !bamin->hdr->target_len )
             ERROR( "no reference length information available" );
 
-        end = bamin->hdr->target_len[ 0 ];
+        end = bamin->hdr->target_len[ tid ];
     }
+
+    if ( end <= begin )
+        ERROR( "end position must be greater than the begin position" );
 }
 
 args_t::~args_t()
@@ -128,6 +155,14 @@ void args_t::parse_bamfile( const char * input, const char * output )
     bamout = new bamfile_t( output, WRITE );
 }
 
+void args_t::parse_minoverlap( const char * str )
+{
+    min_overlap = atoi( str );
+
+    if ( min_overlap < 0 )
+        ERROR( "minimum overlap must be a non-negative integer, had: %s", str );
+}
+
 void args_t::parse_minreads( const char * str )
 {
     min_reads = atoi( str );
@@ -136,6 +171,17 @@ void args_t::parse_minreads( const char * str )
         ERROR( "minimum reads must be an integer greater than 0, had: %s", str );
 }
 
+void args_t::parse_reference( const char * str )
+{
+    if ( !str )
+        ERROR( "missing argument to -t" );
+
+    tid = bam_get_tid( bamin->hdr, str );
+
+    if ( tid < 0 )
+        ERROR( "unknown reference: %s", str );
+}
+
 void args_t::parse_begin( const char * str )
 {
     begin = atoi( str );
@@ -167,3 +213,21 @@ void args_t::parse_windowsize( const char * str )
     if ( window_size < 1 )
         ERROR( "window size must be an integer greater than 0, had: %s", str );
 }
+
+void args_t::parse_tolgaps()
+{
+    tol_gaps = false;
+}
+
+void args_t::parse_tolambigs()
+{
+    tol_ambigs = false;
+}
+
+void args_t::parse_statsjson( const char * str )
+{
+    if ( !str )
+        ERROR( "missing argument to --stats-json" );
+
+    stats_json = str;
+}
@@ -5,7 +5,7 @@
 #define ARGPARSE_H
 
 // program name
-#define EXEC "merge"
+#define EXEC "sampler"
 
 // argument defaults
 #define DEFAULT_MIN_OVERLAP 0
@@ -24,22 +24,29 @@ public:
     bamfile::bamfile_t * bamout;
     int min_overlap;
     int min_reads;
+    int tid;
     int begin;
     int end;
     int window_size;
     int stride;
     bool tol_gaps;
     bool tol_ambigs;
+    const char * stats_json;
 
     args_t( int, const char ** );
     ~args_t();
 private:
     void parse_bamfile( const char *, const char * );
+    void parse_minoverlap( const char * );
     void parse_minreads( const char * );
+    void parse_reference( const char * );
     void parse_begin( const char * );
     void parse_end( const char * );
     void parse_windowsize( const char * );
     void parse_stride( const char * );
+    void parse_tolgaps();
+    void parse_tolambigs();
+    void parse_statsjson( const char * );
 };
 
 #endif // ARGPARSE_H
@@ -1,82 +1,55 @@
 
-#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <iostream>
 #include <vector>
 
-#include "aligned.h"
+#include "bam.h"
+
+#include "aligned.hpp"
 #include "args.hpp"
 #include "bamfile.hpp"
 #include "merge.hpp"
+#include "stats.hpp"
 
 
-using std::sort;
+using std::cerr;
+using std::deque;
+using std::endl;
 using std::vector;
 
-using merge::ERROR;
-using merge::SUCCESS;
-using merge::aligned_destroy;
-using merge::merge_clusters;
-using merge::merge_two;
-using merge::ncontrib_cmp;
-using merge::res_t;
+using aligned::aligned_t;
+using merge::cluster_t;
+using merge::merge_reads;
 
 
-#define MERGE_SIZE 128
+// number of windows merged in parallel at a time
+#define SAMPLER_BATCH 64
 #define MIN( a, b ) ( ( (a) < (b) ) ? (a) : (b) )
 
 
-int merge_(
-    args_t & args,
-    vector< aligned_t > & reads,
-    vector< aligned_t > & clusters
+// the clusters of the reads overlapping [ begin, end ), clipped to it
+vector< cluster_t > merge_window(
+    const args_t & args,
+    const deque< aligned_t > & reads,
+    const int begin,
+    const int end
     )
 {
-    vector< aligned_t >::iterator read, cluster;
-    size_t merge_size = MERGE_SIZE, nread = 0;
+    deque< aligned_t >::const_iterator read;
+    vector< cluster_t > clipped;
 
     for ( read = reads.begin(); read != reads.end(); ++read ) {
-        
-        if ( nread % 100 == 0 )
-            fprintf( stderr, "\rprocessed: %9lu reads (%6lu clusters)", nread, clusters.size() );
-
-        for ( cluster = clusters.begin(); cluster != clusters.end(); ++cluster ) {
-            aligned_t merged = { .data = NULL };
-            res_t res = merge_two( *read, *cluster, args, merged );
-            if ( res == SUCCESS ) {
-                // destroy our read and cluster
-                aligned_destroy( *read );
-                aligned_destroy( *cluster );
-                *cluster = merged;
-                if ( clusters.size() > merge_size ) {
-                    if ( merge_clusters( nread, args, clusters ) < 0 )
-                        goto error;
-                    merge_size *= 2;
-                }
-                goto next;
-            }
-            else if ( res == ERROR ) {
-                aligned_destroy( merged );
-                goto error;
-            }
-        }
-        clusters.push_back( *read );
-next:
-        ++nread;
-    }
-
-    if ( merge_clusters( nread, args, clusters ) < 0 )
-        goto error;
-
-    fprintf( stderr, "\rprocessed: %9lu reads (%6lu clusters)\n", nread, clusters.size() );
+        if ( read->rpos() < begin || read->lpos() >= end )
+            continue;
 
-    sort( clusters.begin(), clusters.end(), ncontrib_cmp );
+        cluster_t cluster = cluster_t( *read ).clip( begin, end );
 
-    return clusters.size();
-
-error:
-    for ( ; read != reads.end(); ++read )
-        aligned_destroy( *read );
+        if ( cluster.size() )
+            clipped.push_back( std::move( cluster ) );
+    }
 
-    return 0;
+    return merge_reads( clipped, args.min_overlap, args.tol_ambigs, args.tol_gaps );
 }
 
 // main ------------------------------------------------------------------------------------------------------------- //
@@ -84,30 +57,83 @@ error:
 int main( int argc, const char * argv[] )
 {
     args_t args = args_t( argc, argv );
-    size_t k = 0;
-
-    args.bamout->write_header( args.bamin->hdr );
+    bam1_t * const bam = bam_init1();
+    vector< int > begins;
+    unsigned long k = 0;
 
-    for ( int i = args.begin; i < args.end; i += args.stride ) {
-        int j = MIN( i + args.window_size, args.end );
-        vector< aligned_t > reads;
-        vector< aligned_t > clusters;
-        vector< aligned_t >::iterator cluster;
+    stats::dump_at_exit( args.stats_json, EXEC );
 
-        args.bamin->fetch( reads, i, j );
+    if ( !args.bamout->write_header( args.bamin->hdr ) ) {
+        cerr << "error writing out BAM header" << endl;
+        goto error;
+    }
 
-        if ( merge_( args, reads, clusters ) )
-            for ( cluster = clusters.begin();
-                    cluster->ncontrib >= args.min_reads && cluster != clusters.end();
+    for ( int i = args.begin; i < args.end; i += args.stride )
+        begins.push_back( i );
+
+    // fetch the reads of a batch of windows at once, from a cache sliding along
+    // with the batches so that every read is decoded only once, then merge
+    // the windows in parallel and write them out in order
+    for ( unsigned b = 0; b < begins.size(); b += SAMPLER_BATCH ) {
+        const int nwindow = MIN( SAMPLER_BATCH, int( begins.size() - b ) );
+        vector< vector< cluster_t > > windows( nwindow );
+        stats::scope_t decode( stats::DECODE );
+        const deque< aligned_t > & reads = args.bamin->fetch_window(
+            begins[ b ],
+            MIN( begins[ b + nwindow - 1 ] + args.window_size, args.end ),
+            args.tid
+            );
+
+        decode.stop();
+
+        stats::scope_t scope( stats::MERGE );
+
+        #pragma omp parallel for schedule( dynamic, 1 )
+        for ( int w = 0; w < nwindow; ++w )
+            windows[ w ] = merge_window(
+                args,
+                reads,
+                begins[ b + w ],
+                MIN( begins[ b + w ] + args.window_size, args.end )
+                );
+
+        scope.stop();
+
+        stats::scope_t write( stats::WRITE );
+
+        for ( int w = 0; w < nwindow; ++w ) {
+            const int i = begins[ b + w ], j = MIN( i + args.window_size, args.end );
+            vector< cluster_t >::const_iterator cluster;
+
+            // clusters are sorted by decreasing ncontrib
+            for ( cluster = windows[ w ].begin();
+                    cluster != windows[ w ].end() && cluster->ncontrib >= args.min_reads;
                     ++cluster ) {
-                char qname[ 256 ];
-                snprintf( qname, 256, "cluster%lu_%ib_%ie_%dr", k++, i, j, cluster->ncontrib );
-                args.bamout->write( qname, *cluster, i, j );
-            }
+                aligned_t aligned = cluster->to_aligned();
+                char name[ 256 ];
+
+                snprintf( name, 256, "cluster%lu_%ib_%ie_%dr", k++, i, j, cluster->ncontrib );
+                aligned.name += name;
 
-        for ( cluster = clusters.begin(); cluster != clusters.end(); ++cluster )
-            aligned_destroy( *cluster );
+                if ( !aligned.to_bam( bam ) ) {
+                    cerr << "error converting to BAM format" << endl;
+                    goto error;
+                }
+
+                if ( !args.bamout->write( bam ) ) {
+                    cerr << "error writing to BAM_OUT" << endl;
+                    goto error;
+                }
+            }
+        }
     }
 
+    bam_destroy1( bam );
+
     return 0;
+
+error:
+    bam_destroy1( bam );
+
+    return -1;
 }
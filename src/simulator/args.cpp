@@ -0,0 +1,246 @@
+
+/* argument parsing ------------------------------------------------------------------------------------------------- */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "args.hpp"
+
+
+using bamfile::WRITE;
+using bamfile::bamfile_t;
+
+
+// some crazy shit for stringifying preprocessor directives
+#define STRIFY(x) #x
+#define TO_STR(x) STRIFY(x)
+
+const char usage[] =
+    "usage: " EXEC " [-h] "
+    "[-T TRUTH] "
+    "[-d DEPTH] "
+    "[-l LENGTH] "
+    "[-n READ_LENGTH] "
+    "[-o OVERLAP] "
+    "[-e ERROR_RATE] "
+    "[-i INDEL_RATE] "
+    "[-v VARIANT_RATE] "
+    "[-H FREQS] "
+    "[-s SEED] "
+    "(-B BAM_OUT)\n";
+
+const char help_msg[] =
+    "simulate amplicon sequencing of a mixture of haplotypes\n"
+    "\n"
+    "required arguments:\n"
+    "  -B BAM_OUT               coordinate-sorted BAM output file\n"
+    "\n"
+    "optional arguments:\n"
+    "  -h, --help               show this help message and exit\n"
+    "  -T TRUTH                 write the haplotypes and their variants to TRUTH\n"
+    "  -d DEPTH                 reads per amplicon (default="
+                                TO_STR( DEFAULT_DEPTH ) ")\n"
+    "  -l LENGTH                length of the random reference (default="
+                                TO_STR( DEFAULT_LENGTH ) ")\n"
+    "  -n READ_LENGTH           length of the amplicons, and so the reads (default="
+                                TO_STR( DEFAULT_READ_LENGTH ) ")\n"
+    "  -o OVERLAP               overlap between neighbouring amplicons (default="
+                                TO_STR( DEFAULT_OVERLAP ) ")\n"
+    "  -e ERROR_RATE            per-base substitution error rate of the reads (default="
+                                TO_STR( DEFAULT_ERROR_RATE ) ")\n"
+    "  -i INDEL_RATE            per-base indel error rate of the reads (default="
+                                TO_STR( DEFAULT_INDEL_RATE ) ")\n"
+    "  -v VARIANT_RATE          per-base rate of substitutions between each haplotype\n"
+    "                           and the reference (default="
+                                TO_STR( DEFAULT_VARIANT_RATE ) ")\n"
+    "  -H FREQS                 comma-separated frequencies of the haplotypes, the first\n"
+    "                           being the reference itself; normalized to sum to 1\n"
+    "                           (default=1, the reference alone)\n"
+    "  -s SEED                  random seed (default="
+                                TO_STR( DEFAULT_SEED ) ")\n";
+
+inline
+void help()
+{
+    fprintf( stderr, "%s\n%s", usage, help_msg );
+    exit( 1 );
+}
+
+#define ERROR( msg, args... ) \
+{ \
+    fprintf( stderr, "%s" EXEC ": error: " msg "\n", usage , ##args ); \
+    exit( 1 ); \
+}
+
+// args_t ----------------------------------------------------------------------------------------------------------- //
+
+args_t::args_t( int argc, const char * argv[] ) :
+    bamout( NULL ),
+    truth( NULL ),
+    depth( DEFAULT_DEPTH ),
+    length( DEFAULT_LENGTH ),
+    read_length( DEFAULT_READ_LENGTH ),
+    overlap( DEFAULT_OVERLAP ),
+    error_rate( DEFAULT_ERROR_RATE ),
+    indel_rate( DEFAULT_INDEL_RATE ),
+    variant_rate( DEFAULT_VARIANT_RATE ),
+    seed( DEFAULT_SEED )
+{
+    int i;
+
+    // skip arg[0], it's just the program name
+    for ( i = 1; i < argc; ++i ) {
+        const char * arg = argv[i];
+
+        if ( arg[0] == '-' && arg[1] == '-' ) {
+            if ( !strcmp( &arg[2], "help" ) ) help();
+            else
+                ERROR( "unknown argument: %s", arg );
+        }
+        else if ( arg[0] == '-' ) {
+            if ( !strcmp( &arg[1], "h" ) ) help();
+            else if ( !strcmp( &arg[1], "B" ) ) parse_bamfile( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "T" ) ) parse_truth( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "d" ) ) parse_depth( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "l" ) ) parse_length( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "n" ) ) parse_readlength( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "o" ) ) parse_overlap( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "e" ) ) parse_errorrate( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "i" ) ) parse_indelrate( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "v" ) ) parse_variantrate( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "H" ) ) parse_freqs( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "s" ) ) parse_seed( argv[ ++i ] );
+            else
+                ERROR( "unknown argument: %s", arg );
+        }
+        else
+            ERROR( "unknown argument: %s", arg );
+    }
+
+    if ( !bamout )
+        ERROR( "missing required argument -B BAM_OUT" );
+
+    if ( read_length > length )
+        ERROR( "read length must not exceed the reference length" );
+
+    if ( overlap >= read_length )
+        ERROR( "overlap must be less than the read length" );
+
+    if ( freqs.empty() )
+        freqs.push_back( 1.0 );
+}
+
+args_t::~args_t()
+{
+    delete bamout;
+}
+
+void args_t::parse_bamfile( const char * str )
+{
+    if ( !str )
+        ERROR( "missing argument to -B" );
+
+    bamout = new bamfile_t( str, WRITE );
+}
+
+void args_t::parse_truth( const char * str )
+{
+    if ( !str )
+        ERROR( "missing argument to -T" );
+
+    truth = str;
+}
+
+void args_t::parse_depth( const char * str )
+{
+    depth = str ? atoi( str ) : 0;
+
+    if ( depth < 1 )
+        ERROR( "depth must be an integer greater than 0, had: %s", str ? str : "" );
+}
+
+void args_t::parse_length( const char * str )
+{
+    length = str ? atoi( str ) : 0;
+
+    if ( length < 1 )
+        ERROR( "length must be an integer greater than 0, had: %s", str ? str : "" );
+}
+
+void args_t::parse_readlength( const char * str )
+{
+    read_length = str ? atoi( str ) : 0;
+
+    if ( read_length < 1 )
+        ERROR( "read length must be an integer greater than 0, had: %s", str ? str : "" );
+}
+
+void args_t::parse_overlap( const char * str )
+{
+    overlap = str ? atoi( str ) : -1;
+
+    if ( overlap < 0 )
+        ERROR( "overlap must be a non-negative integer, had: %s", str ? str : "" );
+}
+
+void args_t::parse_errorrate( const char * str )
+{
+    error_rate = str ? atof( str ) : -1.0;
+
+    if ( error_rate < 0.0 || error_rate >= 1.0 )
+        ERROR( "error rate must be a real number in [0.0, 1.0), had: %s", str ? str : "" );
+}
+
+void args_t::parse_indelrate( const char * str )
+{
+    indel_rate = str ? atof( str ) : -1.0;
+
+    if ( indel_rate < 0.0 || indel_rate >= 1.0 )
+        ERROR( "indel rate must be a real number in [0.0, 1.0), had: %s", str ? str : "" );
+}
+
+void args_t::parse_variantrate( const char * str )
+{
+    variant_rate = str ? atof( str ) : -1.0;
+
+    if ( variant_rate < 0.0 || variant_rate >= 1.0 )
+        ERROR( "variant rate must be a real number in [0.0, 1.0), had: %s", str ? str : "" );
+}
+
+void args_t::parse_freqs( const char * str )
+{
+    double sum = 0.0;
+
+    if ( !str )
+        ERROR( "missing argument to -H" );
+
+    freqs.clear();
+
+    for ( const char * p = str; *p; ) {
+        char * end;
+        const double freq = strtod( p, &end );
+
+        if ( end == p || freq < 0.0 || ( *end && *end != ',' ) )
+            ERROR( "invalid haplotype frequencies: %s", str );
+
+        freqs.push_back( freq );
+        sum += freq;
+
+        p = *end ? end + 1 : end;
+    }
+
+    if ( sum <= 0.0 )
+        ERROR( "haplotype frequencies must sum to more than 0, had: %s", str );
+
+    for ( unsigned i = 0; i < freqs.size(); ++i )
+        freqs[ i ] /= sum;
+}
+
+void args_t::parse_seed( const char * str )
+{
+    if ( !str )
+        ERROR( "missing argument to -s" );
+
+    seed = strtoul( str, NULL, 10 );
+}
@@ -0,0 +1,53 @@
+
+#include <vector>
+
+#include "bamfile.hpp"
+
+#ifndef ARGPARSE_H
+#define ARGPARSE_H
+
+// program name
+#define EXEC "simulator"
+
+// argument defaults
+#define DEFAULT_DEPTH 1000
+#define DEFAULT_LENGTH 1000
+#define DEFAULT_READ_LENGTH 250
+#define DEFAULT_OVERLAP 50
+#define DEFAULT_ERROR_RATE 0.001
+#define DEFAULT_INDEL_RATE 0.0001
+#define DEFAULT_VARIANT_RATE 0.01
+#define DEFAULT_SEED 42
+
+class args_t
+{
+public:
+    bamfile::bamfile_t * bamout;
+    const char * truth;
+    int depth;
+    int length;
+    int read_length;
+    int overlap;
+    double error_rate;
+    double indel_rate;
+    double variant_rate;
+    std::vector< double > freqs;
+    unsigned seed;
+
+    args_t( int, const char ** );
+    ~args_t();
+private:
+    void parse_bamfile( const char * );
+    void parse_truth( const char * );
+    void parse_depth( const char * );
+    void parse_length( const char * );
+    void parse_readlength( const char * );
+    void parse_overlap( const char * );
+    void parse_errorrate( const char * );
+    void parse_indelrate( const char * );
+    void parse_variantrate( const char * );
+    void parse_freqs( const char * );
+    void parse_seed( const char * );
+};
+
+#endif // ARGPARSE_H
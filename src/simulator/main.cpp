@@ -0,0 +1,218 @@
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include "bam.h"
+
+#include "aligned.hpp"
+#include "args.hpp"
+#include "bamfile.hpp"
+#include "util.hpp"
+
+
+using std::cerr;
+using std::endl;
+using std::make_pair;
+using std::vector;
+
+using aligned::INS;
+using aligned::MATCH;
+using aligned::aligned_t;
+using aligned::pos_t;
+using util::bits2nuc;
+
+
+#define QUAL 30
+
+
+const char nucs[] = { 1, 2, 4, 8 };
+
+
+inline
+double uniform()
+{
+    return rand() / ( RAND_MAX + 1.0 );
+}
+
+
+// any nucleotide but nuc
+inline
+char substitute( const char nuc )
+{
+    char sub;
+
+    do {
+        sub = nucs[ rand() % 4 ];
+    } while ( sub == nuc );
+
+    return sub;
+}
+
+
+// pick a haplotype according to its frequency
+inline
+int choose( const vector< double > & freqs )
+{
+    double u = uniform();
+    unsigned i = 0;
+
+    for ( ; i + 1 < freqs.size() && u >= freqs[ i ]; ++i )
+        u -= freqs[ i ];
+
+    return i;
+}
+
+
+// a read of hap over [ begin, end ), with substitution and indel errors;
+// the first and last bases are never deleted, so the read keeps its span
+void simulate_read(
+    const args_t & args,
+    const vector< char > & hap,
+    const int begin,
+    const int end,
+    aligned_t & read
+    )
+{
+    read.clear();
+
+    for ( int col = begin; col < end; ++col ) {
+        if ( col > begin && col + 1 < end && uniform() < 0.5 * args.indel_rate )
+            continue;
+
+        pos_t pos( col, MATCH );
+        const char nuc = ( uniform() < args.error_rate ) ? substitute( hap[ col ] ) : hap[ col ];
+
+        pos.push_back( make_pair( nuc, char( QUAL ) ) );
+        read.push_back( pos );
+
+        if ( col + 1 < end && uniform() < 0.5 * args.indel_rate ) {
+            pos_t ins( col, INS );
+
+            ins.push_back( make_pair( nucs[ rand() % 4 ], char( QUAL ) ) );
+            read.push_back( ins );
+        }
+    }
+}
+
+
+// the haplotypes, and the frequency of every variant among them,
+// with 1-based positions as variants reports them
+bool write_truth( const args_t & args, const vector< vector< char > > & haps )
+{
+    FILE * const file = fopen( args.truth, "w" );
+
+    if ( !file )
+        return false;
+
+    for ( unsigned i = 0; i < haps.size(); ++i ) {
+        fprintf( file, "#haplotype\t%u\t%.6f\t", i, args.freqs[ i ] );
+
+        for ( int col = 0; col < args.length; ++col )
+            fputc( bits2nuc( haps[ i ][ col ] ), file );
+
+        fputc( '\n', file );
+    }
+
+    fprintf( file, "#pos\tref\talt\tfreq\n" );
+
+    for ( int col = 0; col < args.length; ++col )
+        for ( int j = 0; j < 4; ++j ) {
+            double freq = 0.0;
+
+            if ( nucs[ j ] == haps[ 0 ][ col ] )
+                continue;
+
+            for ( unsigned i = 1; i < haps.size(); ++i )
+                if ( haps[ i ][ col ] == nucs[ j ] )
+                    freq += args.freqs[ i ];
+
+            if ( freq > 0.0 )
+                fprintf( file, "%d\t%c\t%c\t%.6f\n", col + 1, bits2nuc( haps[ 0 ][ col ] ), bits2nuc( nucs[ j ] ), freq );
+        }
+
+    fclose( file );
+
+    return true;
+}
+
+// main ------------------------------------------------------------------------------------------------------------- //
+
+int main( int argc, const char * argv[] )
+{
+    args_t args = args_t( argc, argv );
+    vector< vector< char > > haps( args.freqs.size(), vector< char >( args.length ) );
+    bam_header_t * const hdr = args.bamout->hdr;
+    bam1_t * const bam = bam_init1();
+    const int step = args.read_length - args.overlap;
+    unsigned long nread = 0;
+    aligned_t read;
+
+    srand( args.seed );
+
+    // haplotype 0 is the reference, the others carry substitutions with respect to it
+    for ( int col = 0; col < args.length; ++col )
+        haps[ 0 ][ col ] = nucs[ rand() % 4 ];
+
+    for ( unsigned i = 1; i < haps.size(); ++i )
+        for ( int col = 0; col < args.length; ++col )
+            haps[ i ][ col ] = ( uniform() < args.variant_rate ) ? substitute( haps[ 0 ][ col ] ) : haps[ 0 ][ col ];
+
+    if ( args.truth && !write_truth( args, haps ) ) {
+        cerr << "unable to write truth to: " << args.truth << endl;
+        goto error;
+    }
+
+    hdr->n_targets = 1;
+    hdr->target_name = reinterpret_cast< char ** >( malloc( sizeof( char * ) ) );
+    hdr->target_name[ 0 ] = strdup( "reference" );
+    hdr->target_len = reinterpret_cast< uint32_t * >( malloc( sizeof( uint32_t ) ) );
+    hdr->target_len[ 0 ] = args.length;
+
+    if ( !args.bamout->write_header() ) {
+        cerr << "error writing out BAM header" << endl;
+        goto error;
+    }
+
+    // amplicons tile the reference, and every read of an amplicon spans all of it,
+    // so reads come out coordinate-sorted without holding any of them
+    for ( int begin = 0; begin < args.length; begin += step ) {
+        const int end = ( begin + args.read_length < args.length ) ? begin + args.read_length : args.length;
+
+        for ( int i = 0; i < args.depth; ++i, ++nread ) {
+            char name[ 64 ];
+
+            simulate_read( args, haps[ choose( args.freqs ) ], begin, end, read );
+
+            snprintf( name, 64, "read%lu", nread );
+            read.name = name;
+
+            if ( !read.to_bam( bam ) ) {
+                cerr << "error converting to BAM format" << endl;
+                goto error;
+            }
+
+            bam->core.bin = bam_reg2bin( bam->core.pos, bam_calend( &bam->core, bam1_cigar( bam ) ) );
+
+            if ( !args.bamout->write( bam ) ) {
+                cerr << "error writing to BAM_OUT" << endl;
+                goto error;
+            }
+        }
+
+        if ( end == args.length )
+            break;
+    }
+
+    bam_destroy1( bam );
+
+    return 0;
+
+error:
+    bam_destroy1( bam );
+
+    return -1;
+}
@@ -0,0 +1,184 @@
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "merge.hpp"
+#include "spill.hpp"
+#include "stats.hpp"
+
+
+using std::cerr;
+using std::endl;
+using std::make_pair;
+using std::sort;
+using std::vector;
+
+using merge::cluster_t;
+using merge::nuc_t;
+
+
+namespace spill
+{
+    // on disk, a cluster is its ncontrib and size, then its nucleotides as they are in memory
+    typedef struct {
+        int ncontrib;
+        int size;
+    } record_t;
+
+
+    bool lpos_cmp( const cluster_t & x, const cluster_t & y )
+    {
+        return x.lpos() < y.lpos();
+    }
+
+
+    store_t::store_t() :
+        file( NULL ),
+        nspilled( 0 ),
+        failed( false )
+    {
+    }
+
+
+    store_t::~store_t()
+    {
+        if ( file )
+            fclose( file );
+    }
+
+
+    long store_t::size() const
+    {
+        return nspilled;
+    }
+
+
+    bool store_t::good() const
+    {
+        return !failed;
+    }
+
+
+    bool store_t::spill( vector< cluster_t > & clusters )
+    {
+        vector< cluster_t >::const_iterator cluster;
+        long begin;
+
+        if ( !file && !( file = tmpfile() ) ) {
+            cerr << "unable to create a temporary file to spill clusters to" << endl;
+            failed = true;
+            return false;
+        }
+
+        sort( clusters.begin(), clusters.end(), lpos_cmp );
+
+        begin = ftell( file );
+
+        for ( cluster = clusters.begin(); cluster != clusters.end(); ++cluster ) {
+            record_t rec;
+
+            rec.ncontrib = cluster->ncontrib;
+            rec.size = cluster->size();
+
+            if ( fwrite( &rec, sizeof( record_t ), 1, file ) != 1 ||
+                    fwrite( &( *cluster )[ 0 ], sizeof( nuc_t ), rec.size, file ) != size_t( rec.size ) ) {
+                cerr << "error spilling clusters to disk" << endl;
+                failed = true;
+                return false;
+            }
+        }
+
+        runs.push_back( make_pair( begin, ftell( file ) ) );
+        nspilled += clusters.size();
+        stats::add( stats::CLUSTERS_SPILLED, clusters.size() );
+
+        vector< cluster_t >().swap( clusters );
+
+        return true;
+    }
+
+
+    // read the next cluster of run into its front, if it has one
+    bool store_t::read( const int run )
+    {
+        long & next = runs[ run ].first;
+        record_t rec;
+        size_t nbytes;
+
+        if ( next >= runs[ run ].second )
+            return false;
+
+        if ( pread( fileno( file ), &rec, sizeof( record_t ), next ) != ssize_t( sizeof( record_t ) ) )
+            goto error;
+
+        nbytes = rec.size * sizeof( nuc_t );
+        buf.resize( nbytes );
+
+        if ( pread( fileno( file ), &buf[ 0 ], nbytes, next + sizeof( record_t ) ) != ssize_t( nbytes ) )
+            goto error;
+
+        next += sizeof( record_t ) + nbytes;
+
+        fronts[ run ].ncontrib = rec.ncontrib;
+        fronts[ run ].assign(
+            reinterpret_cast< const nuc_t * >( &buf[ 0 ] ),
+            reinterpret_cast< const nuc_t * >( &buf[ 0 ] ) + rec.size
+            );
+
+        heads.push( make_pair( fronts[ run ].lpos(), run ) );
+
+        return true;
+
+    error:
+        cerr << "error reading spilled clusters back from disk" << endl;
+        next = runs[ run ].second;
+        failed = true;
+
+        return false;
+    }
+
+
+    bool store_t::rewind()
+    {
+        if ( !file )
+            return true;
+
+        if ( fflush( file ) ) {
+            cerr << "error spilling clusters to disk" << endl;
+            failed = true;
+            return false;
+        }
+
+        fronts.resize( runs.size() );
+
+        for ( unsigned i = 0; i < runs.size(); ++i )
+            if ( runs[ i ].first < runs[ i ].second && !read( i ) )
+                return false;
+
+        return true;
+    }
+
+
+    bool store_t::next( cluster_t & cluster )
+    {
+        int run;
+
+        if ( heads.empty() )
+            return false;
+
+        run = heads.top().second;
+        heads.pop();
+
+        cluster.swap( fronts[ run ] );
+
+        // a run that can't be read any further is done, or failed
+        read( run );
+
+        return true;
+    }
+}
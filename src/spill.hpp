@@ -0,0 +1,57 @@
+
+#include <cstdio>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "merge.hpp"
+
+
+#ifndef SPILL_H
+#define SPILL_H
+
+namespace spill
+{
+    // clusters kept on disk rather than in memory: every spill appends a run
+    // of clusters, sorted by lpos(), to one temporary file, and the runs are
+    // read back merged into a single stream, again sorted by lpos()
+    class store_t
+    {
+    private:
+        typedef std::pair< int, int > head_t; // ( lpos, run )
+
+        FILE * file;
+        long nspilled;
+        bool failed;
+        // every run's [ next, end ) offsets into file
+        std::vector< std::pair< long, long > > runs;
+        std::vector< merge::cluster_t > fronts;
+        std::priority_queue< head_t, std::vector< head_t >, std::greater< head_t > > heads;
+        std::vector< char > buf;
+
+        // we own the file, so no copies
+        store_t( const store_t & );
+        store_t & operator=( const store_t & );
+
+        bool read( const int run );
+
+    public:
+        store_t();
+        ~store_t();
+
+        // how many clusters have been spilled
+        long size() const;
+        // false once anything failed to be written or read back
+        bool good() const;
+
+        // move clusters out to a new run, leaving clusters empty
+        bool spill( std::vector< merge::cluster_t > & clusters );
+
+        // start reading back; after this, nothing more can be spilled
+        bool rewind();
+        bool next( merge::cluster_t & cluster );
+    };
+}
+
+#endif // SPILL_H
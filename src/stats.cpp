@@ -0,0 +1,320 @@
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "stats.hpp"
+
+
+namespace stats
+{
+    const char * const stage_names[ NSTAGE ] = {
+        "decode",
+        "convert",
+        "merge",
+        "pileup",
+        "fit",
+        "call",
+        "write"
+    };
+
+    const char * const pool_names[ NPOOL ] = {
+        "clusters",
+        "coverage",
+        "em",
+        "bam"
+    };
+
+    const char * const counter_names[ NCOUNTER ] = {
+        "reads",
+        "bytes_decoded",
+        "merge_attempts",
+        "merge_successes",
+        "merge_rejects",
+        "allocations",
+        "records_written",
+        "clusters_spilled"
+    };
+
+
+    inline
+    double wall_time()
+    {
+        struct timeval tv;
+
+        gettimeofday( &tv, NULL );
+
+        return tv.tv_sec + 1e-6 * tv.tv_usec;
+    }
+
+
+    inline
+    double cpu_time()
+    {
+        struct rusage ru;
+
+        getrusage( RUSAGE_SELF, &ru );
+
+        return ru.ru_utime.tv_sec + 1e-6 * ru.ru_utime.tv_usec +
+            ru.ru_stime.tv_sec + 1e-6 * ru.ru_stime.tv_usec;
+    }
+
+
+    // in bytes, though Linux reports kilobytes
+    inline
+    long max_rss()
+    {
+        struct rusage ru;
+
+        getrusage( RUSAGE_SELF, &ru );
+
+        return 1024L * ru.ru_maxrss;
+    }
+
+
+    long counters[ NCOUNTER ];
+    double stage_wall[ NSTAGE ];
+    double stage_cpu[ NSTAGE ];
+    long stage_calls[ NSTAGE ];
+    long stage_peak[ NSTAGE ];
+    long pool_bytes[ NPOOL ];
+    long pool_peak[ NPOOL ];
+    long total_bytes = 0;
+    long total_peak = 0;
+    long budget = 0;
+    const double start_wall = wall_time();
+    const char * exit_path = NULL;
+    const char * exit_exec = NULL;
+    // stages are timed only once there is somewhere to dump them,
+    // sparing untimed runs two system calls per scope
+    bool enabled = false;
+    bool active[ NSTAGE ];
+
+
+    // counters, pools and stages are written from many threads at once,
+    // so every read of them is atomic too
+    template < class T >
+    inline
+    T load( const T & x )
+    {
+        return __atomic_load_n( &x, __ATOMIC_RELAXED );
+    }
+
+
+    inline
+    bool in_parallel()
+    {
+#ifdef _OPENMP
+        return omp_in_parallel();
+#else
+        return false;
+#endif
+    }
+
+
+    void add( const counter_t counter, const long n )
+    {
+        #pragma omp atomic
+        counters[ counter ] += n;
+    }
+
+
+    long get( const counter_t counter )
+    {
+        return load( counters[ counter ] );
+    }
+
+
+    inline
+    void raise( long & peak, const long bytes )
+    {
+        for ( long old = load( peak ); bytes > old; old = load( peak ) )
+            if ( __sync_bool_compare_and_swap( &peak, old, bytes ) )
+                break;
+    }
+
+
+    void track( const pool_t pool, const long bytes )
+    {
+        const long pool_now = __sync_add_and_fetch( &pool_bytes[ pool ], bytes );
+        const long total_now = __sync_add_and_fetch( &total_bytes, bytes );
+
+        if ( bytes <= 0 )
+            return;
+
+        raise( pool_peak[ pool ], pool_now );
+        raise( total_peak, total_now );
+
+        for ( int i = 0; i < NSTAGE; ++i )
+            if ( load( active[ i ] ) )
+                raise( stage_peak[ i ], total_now );
+    }
+
+
+    long tracked()
+    {
+        return load( total_bytes );
+    }
+
+
+    long tracked( const pool_t pool )
+    {
+        return load( pool_bytes[ pool ] );
+    }
+
+
+    void set_budget( const long bytes )
+    {
+        budget = bytes;
+    }
+
+
+    long get_budget()
+    {
+        return budget;
+    }
+
+
+    bool over_budget()
+    {
+        return budget && load( total_bytes ) > budget;
+    }
+
+
+    bool parse_bytes( const char * str, long & bytes )
+    {
+        char * end;
+        const double value = strtod( str, &end );
+        double unit = 1.0;
+
+        if ( end == str || value < 0.0 )
+            return false;
+
+        switch ( *end ) {
+        case 'G': case 'g': unit *= 1024.0; // fall through
+        case 'M': case 'm': unit *= 1024.0; // fall through
+        case 'K': case 'k': unit *= 1024.0; ++end; break;
+        default: break;
+        }
+
+        if ( *end )
+            return false;
+
+        bytes = long( value * unit );
+
+        return true;
+    }
+
+
+    scope_t::scope_t( const stage_t stage ) :
+        stage( stage ),
+        wall( 0.0 ),
+        cpu( 0.0 ),
+        running( enabled && !in_parallel() && !active[ stage ] )
+    {
+        if ( running ) {
+            __atomic_store_n( &active[ stage ], true, __ATOMIC_RELAXED );
+            raise( stage_peak[ stage ], load( total_bytes ) );
+            wall = wall_time();
+            cpu = cpu_time();
+        }
+    }
+
+
+    scope_t::~scope_t()
+    {
+        stop();
+    }
+
+
+    void scope_t::stop()
+    {
+        if ( !running )
+            return;
+
+        running = false;
+        __atomic_store_n( &active[ stage ], false, __ATOMIC_RELAXED );
+        stage_wall[ stage ] += wall_time() - wall;
+        stage_cpu[ stage ] += cpu_time() - cpu;
+        ++stage_calls[ stage ];
+    }
+
+
+    bool dump_json( const char * path, const char * exec )
+    {
+        FILE * const file = fopen( path, "w" );
+        const char * sep = "";
+
+        if ( !file )
+            return false;
+
+        fprintf( file, "{\n" );
+        fprintf( file, "  \"exec\": \"%s\",\n", exec );
+        fprintf( file, "  \"wall\": %.6f,\n", wall_time() - start_wall );
+        fprintf( file, "  \"cpu\": %.6f,\n", cpu_time() );
+        fprintf( file, "  \"stages\": {" );
+
+        for ( int i = 0; i < NSTAGE; ++i ) {
+            if ( !stage_calls[ i ] )
+                continue;
+
+            fprintf(
+                file,
+                "%s\n    \"%s\": { \"wall\": %.6f, \"cpu\": %.6f, \"calls\": %ld, \"peak_bytes\": %ld }",
+                sep, stage_names[ i ], stage_wall[ i ], stage_cpu[ i ], stage_calls[ i ], load( stage_peak[ i ] )
+                );
+            sep = ",";
+        }
+
+        fprintf( file, "\n  },\n" );
+        fprintf( file, "  \"counters\": {" );
+
+        for ( int i = 0; i < NCOUNTER; ++i )
+            fprintf( file, "%s\n    \"%s\": %ld", i ? "," : "", counter_names[ i ], get( counter_t( i ) ) );
+
+        fprintf( file, "\n  },\n" );
+        fprintf( file, "  \"memory\": {\n" );
+        fprintf( file, "    \"max_rss\": %ld,\n", max_rss() );
+        fprintf( file, "    \"budget\": %ld,\n", budget );
+        fprintf( file, "    \"peak_bytes\": %ld,\n", load( total_peak ) );
+        fprintf( file, "    \"pools\": {" );
+
+        for ( int i = 0; i < NPOOL; ++i )
+            fprintf(
+                file,
+                "%s\n      \"%s\": { \"bytes\": %ld, \"peak_bytes\": %ld }",
+                i ? "," : "", pool_names[ i ], load( pool_bytes[ i ] ), load( pool_peak[ i ] )
+                );
+
+        fprintf( file, "\n    }\n  }\n}\n" );
+
+        return fclose( file ) == 0;
+    }
+
+
+    void dump_exit()
+    {
+        if ( !dump_json( exit_path, exit_exec ) )
+            fprintf( stderr, "unable to write stats to: %s\n", exit_path );
+    }
+
+
+    void dump_at_exit( const char * path, const char * exec )
+    {
+        if ( !path )
+            return;
+
+        if ( !exit_path )
+            atexit( dump_exit );
+
+        exit_path = path;
+        exit_exec = exec;
+        enabled = true;
+    }
+}
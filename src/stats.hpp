@@ -0,0 +1,129 @@
+
+#include <cstddef>
+#include <memory>
+
+
+#ifndef STATS_H
+#define STATS_H
+
+namespace stats
+{
+    // stages are inclusive: a stage timed inside another counts towards both
+    enum stage_t {
+        DECODE,     // reading BAM records, and decoding them into aligned_t
+        CONVERT,    // converting between aligned_t and cluster_t
+        MERGE,      // merging reads and clusters
+        PILEUP,     // building coverage
+        FIT,        // fitting the background model
+        CALL,       // calling variants
+        WRITE,      // encoding and writing out BAM records
+        NSTAGE
+    };
+
+    enum counter_t {
+        READS,              // BAM records read
+        BYTES_DECODED,      // bytes of BAM record data read
+        MERGE_ATTEMPTS,     // calls to cluster_t::merge
+        MERGE_SUCCESSES,    // ... which merged
+        MERGE_REJECTS,      // ... which didn't
+        ALLOCATIONS,        // BAM record buffers allocated
+        RECORDS_WRITTEN,    // BAM records written
+        CLUSTERS_SPILLED,   // clusters spilled to disk
+        NCOUNTER
+    };
+
+    // memory we keep track of, by what holds it
+    enum pool_t {
+        CLUSTERS,   // the nucleotides of cluster_t
+        COVERAGE,   // the columns and observations of coverage_t, estimated
+        EM,         // EM's responsibilities
+        BAM,        // BAM record buffers we allocate ourselves
+        NPOOL
+    };
+
+    // add n to counter; safe to call from within a parallel region
+    void add( const counter_t counter, const long n = 1 );
+    long get( const counter_t counter );
+
+    // add bytes to pool, or remove them if negative, noting the peak of
+    // every pool and of every stage underway; safe from parallel regions
+    void track( const pool_t pool, const long bytes );
+    long tracked();
+    long tracked( const pool_t pool );
+
+    // a soft limit on the memory tracked, 0 for none; nothing enforces it,
+    // it's up to whoever holds the memory to check and fail or make do
+    void set_budget( const long bytes );
+    long get_budget();
+    bool over_budget();
+
+    // parse a size such as 512M or 4G (powers of 1024) into bytes
+    bool parse_bytes( const char * str, long & bytes );
+
+    // a std::allocator tracking everything it hands out in pool
+    template < class T, pool_t P >
+    class allocator_t : public std::allocator< T >
+    {
+    public:
+        template < class U >
+        struct rebind
+        {
+            typedef allocator_t< U, P > other;
+        };
+
+        allocator_t()
+        {
+        }
+
+        allocator_t( const allocator_t & other ) :
+            std::allocator< T >( other )
+        {
+        }
+
+        template < class U >
+        allocator_t( const allocator_t< U, P > & )
+        {
+        }
+
+        T * allocate( const size_t n, const void * = 0 )
+        {
+            track( P, n * sizeof( T ) );
+            return std::allocator< T >::allocate( n );
+        }
+
+        void deallocate( T * const p, const size_t n )
+        {
+            track( P, -long( n * sizeof( T ) ) );
+            std::allocator< T >::deallocate( p, n );
+        }
+    };
+
+    // time a stage from construction until stop() or the end of the scope,
+    // in wall and CPU time; CPU time is that of the whole process, so it exceeds
+    // the wall time of a parallel stage. Scopes opened within a parallel region,
+    // or within a scope of the same stage, time nothing: the enclosing scope does
+    class scope_t
+    {
+    private:
+        const stage_t stage;
+        double wall;
+        double cpu;
+        bool running;
+
+        scope_t( const scope_t & );
+        scope_t & operator=( const scope_t & );
+
+    public:
+        scope_t( const stage_t stage );
+        ~scope_t();
+
+        void stop();
+    };
+
+    // write every stage and counter out to path as JSON when the program exits;
+    // until this is called, scopes time nothing
+    void dump_at_exit( const char * path, const char * exec );
+    bool dump_json( const char * path, const char * exec );
+}
+
+#endif // STATS_H
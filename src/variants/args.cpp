@@ -4,12 +4,15 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <vector>
 
 #include "args.hpp"
+#include "stats.hpp"
 
 
 using bamfile::READ;
 using bamfile::bamfile_t;
+using std::vector;
 
 
 // some crazy shit for stringifying preprocessor directives
@@ -17,18 +20,44 @@ using bamfile::bamfile_t;
 #define TO_STR(x) STRIFY(x)
 
 const char usage[] =
-    "usage: " EXEC " [-h] [-c CUTOFF] -B BAM_IN\n";
+    "usage: " EXEC " [-h] [--stats-json PATH] [--memory-budget SIZE] [-c CUTOFF] [-S] [-m MODEL [-u]] [-r REGION] [-L BED] "
+    "[-w PILEUP_OUT] (-B BAM_IN | -p PILEUP | -M MANIFEST [-J])\n";
 
 const char help_msg[] =
     "filter sequencing data using some simple heuristics\n"
     "\n"
-    "required arguments:\n"
+    "required arguments (one or both of):\n"
     "  -B BAM_IN                BAM input file\n"
+    "  -p PILEUP                pileup written by -w, may be repeated to combine pileups\n"
+    "\n"
+    "or, for batch mode:\n"
+    "  -M MANIFEST              process many samples at once, with one sample per line\n"
+    "                           of MANIFEST, as: BAM_IN OUTPUT [MODEL]; each coordinate-\n"
+    "                           sorted BAM_IN is streamed, its variants are written to\n"
+    "                           OUTPUT, and MODEL, if given, is used as with -m;\n"
+    "                           OMP_NUM_THREADS samples are processed concurrently\n"
+    "  -J                       process the samples of MANIFEST jointly: stream every\n"
+    "                           BAM_IN together, fit one background model to all of\n"
+    "                           them (saved to or reused from -m MODEL, if given)\n"
+    "                           and call every sample in a single pass\n"
     "\n"
     "optional arguments:\n"
     "  -h, --help               show this help message and exit\n"
+    "  --stats-json PATH        write per-stage timings and counters to PATH as JSON on exit\n"
+    "  --memory-budget SIZE     stream BAM_IN, or else give up, once the memory tracked\n"
+    "                           exceeds SIZE, e.g. 512M or 4G\n"
     "  -c CUTOFF                mutations with p < CUTOFF will be assumed real (default="
-                                TO_STR( DEFAULT_CUTOFF ) ")\n";
+                                TO_STR( DEFAULT_CUTOFF ) ")\n"
+    "  -S                       stream BAM_IN twice instead of holding its pileup in memory\n"
+    "                           (BAM_IN must be a coordinate-sorted file)\n"
+    "  -m MODEL                 reuse the background model in MODEL if it exists,\n"
+    "                           otherwise save the fitted model there\n"
+    "  -u                       refit the model in MODEL to the new data, starting from\n"
+    "                           the existing fit, and save it back to MODEL\n"
+    "  -r REGION                only call variants within REGION, as chr:begin-end;\n"
+    "                           may be repeated (BAM_IN must be indexed)\n"
+    "  -L BED                   only call variants within the regions of BED (BAM_IN must be indexed)\n"
+    "  -w PILEUP_OUT            save the combined pileup to PILEUP_OUT for reuse with -p\n";
 
 inline
 void help()
@@ -47,8 +76,16 @@ void help()
 
 args_t::args_t( int argc, const char * argv[] ) :
     bamin( NULL ),
-    cutoff( DEFAULT_CUTOFF )
+    cutoff( DEFAULT_CUTOFF ),
+    stream( DEFAULT_STREAM ),
+    model( NULL ),
+    update( DEFAULT_UPDATE ),
+    pileup_out( NULL ),
+    joint( DEFAULT_JOINT ),
+    stats_json( NULL ),
+    memory_budget( 0 )
 {
+    vector< const char * > regions, beds;
     int i;
 
     // skip arg[0], it's just the program name
@@ -57,6 +94,8 @@ args_t::args_t( int argc, const char * argv[] ) :
 
         if ( arg[0] == '-' && arg[1] == '-' ) {
             if ( !strcmp( &arg[2], "help" ) ) help();
+            else if ( !strcmp( &arg[2], "stats-json" ) ) parse_statsjson( argv[++i] );
+            else if ( !strcmp( &arg[2], "memory-budget" ) ) parse_memorybudget( argv[++i] );
 #if 0
             else if ( !strcmp( &arg[2], "fasta" ) ) parse_fasta( argv[++i] );
             else if ( !strcmp( &arg[2], "fastq" ) ) parse_fastq( argv[++i] );
@@ -70,6 +109,15 @@ args_t::args_t( int argc, const char * argv[] ) :
             if ( !strcmp( &arg[1], "h" ) ) help();
             else if ( !strcmp( &arg[1], "B" ) ) parse_bamfile( argv[ ++i ] );
             else if ( !strcmp( &arg[1], "c" ) ) parse_cutoff( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "S" ) ) parse_stream();
+            else if ( !strcmp( &arg[1], "m" ) ) parse_model( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "u" ) ) parse_update();
+            else if ( !strcmp( &arg[1], "r" ) ) regions.push_back( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "L" ) ) beds.push_back( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "p" ) ) parse_pileup( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "w" ) ) parse_pileupout( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "M" ) ) parse_manifest( argv[ ++i ] );
+            else if ( !strcmp( &arg[1], "J" ) ) parse_joint();
             else
                 ERROR( "unknown argument: %s", arg );
         }
@@ -77,8 +125,32 @@ args_t::args_t( int argc, const char * argv[] ) :
             ERROR( "unknown argument: %s", arg );
     }
 
-    if ( !bamin )
-        ERROR( "missing required argument -B BAM_IN" );
+    if ( !samples.empty() && ( bamin || !pileups.empty() || pileup_out || !regions.empty() || !beds.empty() ) )
+        ERROR( "-M MANIFEST can't be used with -B, -p, -w, -r or -L" );
+
+    if ( joint && samples.empty() )
+        ERROR( "-J requires -M MANIFEST" );
+
+    if ( !joint && !samples.empty() && model )
+        ERROR( "-m can only be used with -M MANIFEST in joint mode (-J)" );
+
+    if ( !bamin && pileups.empty() && samples.empty() )
+        ERROR( "missing required argument -B BAM_IN, -p PILEUP or -M MANIFEST" );
+
+    if ( update && !model )
+        ERROR( "-u requires -m MODEL" );
+
+    if ( !bamin && ( stream || !regions.empty() || !beds.empty() ) )
+        ERROR( "-S, -r and -L require -B BAM_IN" );
+
+    if ( pileup_out && ( stream || !regions.empty() || !beds.empty() ) )
+        ERROR( "-w requires the whole pileup, so can't be used with -S, -r or -L" );
+
+    for ( i = 0; i < int( regions.size() ); ++i )
+        parse_region( regions[ i ] );
+
+    for ( i = 0; i < int( beds.size() ); ++i )
+        parse_bed( beds[ i ] );
 }
 
 args_t::~args_t()
@@ -98,3 +170,114 @@ void args_t::parse_cutoff( const char * str )
     if ( cutoff <= 0.0 || cutoff >= 1.0 )
         ERROR( "cutoff must be a real number between 0.0 and 1.0, exclusive" );
 }
+
+void args_t::parse_stream()
+{
+    stream = true;
+}
+
+void args_t::parse_model( const char * str )
+{
+    if ( !str )
+        ERROR( "missing argument to -m" );
+
+    model = str;
+}
+
+void args_t::parse_update()
+{
+    update = true;
+}
+
+void args_t::parse_joint()
+{
+    joint = true;
+}
+
+void args_t::parse_pileup( const char * str )
+{
+    if ( !str )
+        ERROR( "missing argument to -p" );
+
+    pileups.push_back( str );
+}
+
+void args_t::parse_pileupout( const char * str )
+{
+    if ( !str )
+        ERROR( "missing argument to -w" );
+
+    pileup_out = str;
+}
+
+void args_t::parse_region( const char * str )
+{
+    if ( !str || !bamin->add_region( str ) )
+        ERROR( "invalid region: %s", str ? str : "" );
+}
+
+void args_t::parse_bed( const char * str )
+{
+    if ( !str || !bamin->add_bed( str ) )
+        ERROR( "invalid BED file: %s", str ? str : "" );
+}
+
+void args_t::parse_manifest( const char * str )
+{
+    FILE * file;
+    char line[ 4096 ];
+
+    if ( !str )
+        ERROR( "missing argument to -M" );
+
+    file = fopen( str, "r" );
+
+    if ( !file )
+        ERROR( "unable to read manifest: %s", str );
+
+    while ( fgets( line, sizeof( line ), file ) ) {
+        char bam[ 4096 ], output[ 4096 ], model[ 4096 ];
+        sample_t sample;
+        int n;
+
+        if ( line[ 0 ] == '#' )
+            continue;
+
+        n = sscanf( line, "%4095s %4095s %4095s", bam, output, model );
+
+        if ( n <= 0 )
+            continue;
+
+        if ( n < 2 ) {
+            fclose( file );
+            ERROR( "invalid manifest line, expected BAM_IN OUTPUT [MODEL]: %s", line );
+        }
+
+        sample.bamin = bam;
+        sample.output = output;
+
+        if ( n > 2 )
+            sample.model = model;
+
+        samples.push_back( sample );
+    }
+
+    fclose( file );
+
+    if ( samples.empty() )
+        ERROR( "empty manifest: %s", str );
+}
+
+void args_t::parse_statsjson( const char * str )
+{
+    if ( !str )
+        ERROR( "missing argument to --stats-json" );
+
+    stats_json = str;
+}
+
+void args_t::parse_memorybudget( const char * str )
+{
+    if ( !str || !stats::parse_bytes( str, memory_budget ) || memory_budget <= 0 )
+        ERROR( "memory budget must be a positive size, e.g. 512M, had: %s", str ? str : "" );
+}
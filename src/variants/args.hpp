@@ -1,4 +1,7 @@
 
+#include <string>
+#include <vector>
+
 #include "bamfile.hpp"
 
 #ifndef ARGPARSE_H
@@ -8,18 +11,50 @@
 #define EXEC "counter"
 
 #define DEFAULT_CUTOFF 0.01
+#define DEFAULT_STREAM false
+#define DEFAULT_UPDATE false
+#define DEFAULT_JOINT false
+
+// one line of a batch manifest
+class sample_t
+{
+public:
+    std::string bamin;
+    std::string output;
+    std::string model;
+};
 
 class args_t
 {
 public:
     bamfile::bamfile_t * bamin;
     double cutoff;
+    bool stream;
+    const char * model;
+    bool update;
+    std::vector< const char * > pileups;
+    const char * pileup_out;
+    std::vector< sample_t > samples;
+    bool joint;
+    const char * stats_json;
+    long memory_budget;
 
     args_t( int, const char ** );
     ~args_t();
 private:
     void parse_bamfile( const char * );
     void parse_cutoff( const char * );
+    void parse_stream();
+    void parse_model( const char * );
+    void parse_update();
+    void parse_pileup( const char * );
+    void parse_pileupout( const char * );
+    void parse_region( const char * );
+    void parse_bed( const char * );
+    void parse_manifest( const char * );
+    void parse_joint();
+    void parse_statsjson( const char * );
+    void parse_memorybudget( const char * );
 };
 
 #endif // ARGPARSE_H
@@ -1,5 +1,7 @@
 
+#include <climits>
 #include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <list>
 #include <map>
@@ -12,12 +14,15 @@
 #include "aligned.hpp"
 #include "args.hpp"
 #include "bamfile.hpp"
+#include "cohort.hpp"
 #include "coverage.hpp"
 #include "math.hpp"
 #include "rateclass.hpp"
+#include "stats.hpp"
 #include "util.hpp"
 
 
+using std::cerr;
 using std::cout;
 using std::endl;
 using std::exp;
@@ -31,90 +36,110 @@ using std::vector;
 
 using aligned::MATCH;
 using aligned::aligned_t;
+using bamfile::bamfile_t;
+using cohort::cohort_t;
+using cohort::column_t;
+using coverage::cov_t;
 using coverage::coverage_t;
 using coverage::elem_t;
-using math::prob_background;
+using coverage::pileup_t;
+using math::lg_factorial_reserve;
+using math::lg_prob_background;
 using math::weighted_harmonic_mean;
 using rateclass::params_json_dump;
+using rateclass::params_json_load;
 using rateclass::rateclass_t;
 using util::bits2nuc;
 
 
-int main( int argc, const char * argv[] )
-{
-    args_t args = args_t( argc, argv );
-    coverage_t::const_iterator cit;
-    coverage_t coverage;
-    vector< pair< int, int > > data;
-    bam1_t * const in_bam = bam_init1();
+typedef map< elem_t, int >::const_iterator obs_citer;
 
-    while ( args.bamin->next( in_bam ) ) {
-        aligned_t read( in_bam );
-        coverage.include( read );
-    }
-
-    bam_destroy1( in_bam );
-    
-    for ( cit = coverage.begin(); cit != coverage.end(); ++cit ) {
-        map< elem_t, int >::const_iterator it;
 
-        if ( cit->op != MATCH )
-            continue;
+// total coverage and majority count of a match column,
+// returns false if the column is of no interest
+inline
+bool column_stats( const cov_t & col, int & cov, int & max )
+{
+    obs_citer it;
 
-        it = cit->obs.begin();
+    if ( col.op != MATCH )
+        return false;
 
-        if ( it == cit->obs.end() )
-            continue;
+    it = col.obs.begin();
 
-        int cov = it->second;
-        int max = it->second;
+    if ( it == col.obs.end() )
+        return false;
 
-        for ( ++it; it != cit->obs.end(); ++it ) {
-            cov += it->second;
-            if ( it->second > max )
-                max = it->second;
-        }
+    cov = it->second;
+    max = it->second;
 
-        for ( it = cit->obs.begin(); it != cit->obs.end(); ++it )
-            if ( it->second && it->second != max )
-                data.push_back( make_pair( cov, cov - it->second ) );
+    for ( ++it; it != col.obs.end(); ++it ) {
+        cov += it->second;
+        if ( it->second > max )
+            max = it->second;
     }
 
-    rateclass_t rc( data, 3 );
-    double lg_L, aicc;
-    vector< pair< double, double > > params;
+    return true;
+}
 
-    rc( lg_L, aicc, params );
 
-    const double bg = weighted_harmonic_mean( params );
-    const double lg_bg = log( bg );
-    const double lg_invbg = log( 1.0 - bg );
+// first pass: collect the ( coverage, majority ) sufficient statistics
+class data_t
+{
+public:
+    vector< pair< int, int > > data;
+    int max_cov;
 
-    params_json_dump( stderr, lg_L, aicc, params, bg );
+    data_t() :
+        max_cov( 0 )
+    {
+    }
 
-    for ( cit = coverage.begin(); cit != coverage.end(); ++cit ) {
-        map< elem_t, int >::const_iterator it;
+    void operator()( const cov_t & col )
+    {
+        int cov, max;
 
-        if ( cit->op != MATCH )
-            continue;
+        if ( !column_stats( col, cov, max ) )
+            return;
 
-        it = cit->obs.begin();
+        if ( cov > max_cov )
+            max_cov = cov;
 
-        if ( it == cit->obs.end() )
-            continue;
+        for ( obs_citer it = col.obs.begin(); it != col.obs.end(); ++it )
+            if ( it->second && it->second != max )
+                data.push_back( make_pair( cov, cov - it->second ) );
+    }
+};
 
-        int cov = it->second;
-        int max = it->second;
 
-        for ( ++it; it != cit->obs.end(); ++it ) {
-            cov += it->second;
-            if ( it->second > max )
-                max = it->second;
-        }
+// second pass: report the variants unlikely to be background
+class caller_t
+{
+private:
+    const double lg_bg;
+    const double lg_invbg;
+    const double lg_cutoff;
+    FILE * const out;
+
+public:
+    caller_t( const double bg, const double cutoff, FILE * const out = stdout ) :
+        lg_bg( log( bg ) ),
+        lg_invbg( log( 1.0 - bg ) ),
+        lg_cutoff( log( cutoff ) ),
+        out( out )
+    {
+    }
 
+    void operator()( const cov_t & col ) const
+    {
+        obs_citer it;
+        int cov, max;
         string css;
 
-        for ( it = cit->obs.begin(); it != cit->obs.end(); ++it )
+        if ( !column_stats( col, cov, max ) )
+            return;
+
+        for ( it = col.obs.begin(); it != col.obs.end(); ++it )
             if ( it->second == max ) {
                 string elem;
                 it->first.get_seq( elem );
@@ -125,25 +150,450 @@ int main( int argc, const char * argv[] )
         // erase the trailing slash, in a compatible way
         css.erase( --css.end() );
 
-        for ( it = cit->obs.begin(); it != cit->obs.end(); ++it ) {
+        for ( it = col.obs.begin(); it != col.obs.end(); ++it ) {
             string elem;
 
             if ( !it->second || it->second == max )
                 continue;
 
-            const double prob = prob_background( lg_bg, lg_invbg, cov, it->second );
+            const double lg_prob = lg_prob_background( lg_bg, lg_invbg, cov, it->second );
 
-            if ( prob >= args.cutoff )
+            if ( lg_prob >= lg_cutoff )
                 continue;
 
-            fprintf( stdout, "%d\t%s\t%d\t", cit->col + 1, css.c_str(), cov );
+            fprintf( out, "%d\t%s\t%d\t", col.col + 1, css.c_str(), cov );
 
             it->first.get_seq( elem );
-            fprintf( stdout, "%s:%d:%.3e\n", elem.c_str(), it->second, prob );
+            fprintf( out, "%s:%d:%.3e\n", elem.c_str(), it->second, exp( lg_prob ) );
         }
 
-        fflush( stdout );
+        fflush( out );
+    }
+};
+
+
+template < class F >
+void for_each_column( list< cov_t > & cols, F & func )
+{
+    list< cov_t >::const_iterator cit;
+
+    for ( cit = cols.begin(); cit != cols.end(); ++cit )
+        func( *cit );
+
+    cols.clear();
+}
+
+
+// as above, but skipping the columns outside of BAM_IN's regions
+template < class F >
+void for_each_column( list< cov_t > & cols, F & func, const bamfile_t & bamfile, const int tid )
+{
+    list< cov_t >::const_iterator cit;
+
+    for ( cit = cols.begin(); cit != cols.end(); ++cit )
+        if ( bamfile.in_regions( tid, cit->col ) )
+            func( *cit );
+
+    cols.clear();
+}
+
+
+// hand every column of a memory-mapped pileup to func, one at a time
+template < class F >
+void for_each_column( const pileup_t & pileup, F & func )
+{
+    cov_t cov( 0, MATCH );
+
+    for ( size_t i = 0; i < pileup.size(); ++i ) {
+        pileup.get( i, cov );
+        func( cov );
     }
+}
+
+
+// hand every column of BAM_IN to func, retaining only the columns
+// still overlapped by the current read; requires coordinate-sorted input
+template < class F >
+void stream_columns( bamfile_t & bamfile, F & func )
+{
+    coverage_t coverage;
+    list< cov_t > done;
+    bam1_t * const in_bam = bam_init1();
+    aligned_t read;
+    int tid = -1, cutoff = -1;
+
+    while ( bamfile.next( in_bam ) ) {
+        if ( in_bam->core.tid != tid ) {
+            coverage.release( INT_MAX, done );
+            for_each_column( done, func, bamfile, tid );
+            tid = in_bam->core.tid;
+            cutoff = -1;
+        }
+        else if ( in_bam->core.pos - 1 < cutoff ) {
+            cerr << "BAM_IN must be coordinate-sorted to stream it" << endl;
+            exit( 1 );
+        }
+
+        cutoff = in_bam->core.pos - 1;
+        coverage.release( cutoff, done );
+        for_each_column( done, func, bamfile, tid );
+
+        read.from_bam( in_bam );
+        coverage.include( read );
+    }
+
+    coverage.release( INT_MAX, done );
+    for_each_column( done, func, bamfile, tid );
+
+    bam_destroy1( in_bam );
+}
+
+
+// fit the background model to data, or refit it starting from params,
+// and save it to path, if we have one; seed drives the fit's random restarts
+void fit_model(
+        const data_t & data,
+        const bool refit,
+        const char * const path,
+        double & lg_L,
+        double & aicc,
+        vector< pair< double, double > > & params,
+        double & bg,
+        const unsigned seed = 1
+        )
+{
+    stats::scope_t scope( stats::FIT );
+    rateclass_t rc( data.data, 3, seed );
+
+    if ( refit )
+        rc.refit( lg_L, aicc, params );
+    else
+        rc( lg_L, aicc, params );
+
+    bg = weighted_harmonic_mean( params );
+
+    if ( path ) {
+        FILE * const out = fopen( path, "w" );
+
+        if ( !out ) {
+            cerr << "unable to write model to: " << path << endl;
+            exit( 1 );
+        }
+
+        params_json_dump( out, lg_L, aicc, params, bg, 17, "variants" );
+        fclose( out );
+    }
+}
+
+
+// hand every column of the cohort to funcs, one functor per sample,
+// as though each sample had been streamed on its own
+template < class F >
+void stream_cohort( const vector< bamfile_t * > & bams, vector< F * > & funcs )
+{
+    cohort_t cohort( bams );
+    column_t column( -1, 0, MATCH );
+    cov_t cov( 0, MATCH );
+
+    while ( cohort.next( column ) )
+        for ( int i = 0; i < cohort.size(); ++i )
+            if ( column.get( i, cov ) )
+                ( *funcs[ i ] )( cov );
+}
+
+
+// call variants on every sample of the manifest, several samples at a time:
+// each worker streams its BAM twice, and a sample's ( coverage, majority )
+// data lives only as long as the task fitting its model, so memory is
+// bounded by the number of threads (OMP_NUM_THREADS) rather than by the
+// number or size of the samples; what's kept between passes is a background
+// and a few rate classes per sample
+int run_batch( const args_t & args )
+{
+    const int nsample = args.samples.size();
+    vector< double > lg_Ls( nsample ), aiccs( nsample ), bgs( nsample );
+    vector< vector< pair< double, double > > > params( nsample );
+    vector< int > max_covs( nsample, 0 );
+    int max_cov = 0;
+    stats::scope_t pileup( stats::PILEUP );
+
+    // first pass: reuse the models we have, and fit the rest; being within
+    // a parallel region, fitting is timed as part of the pileup, and it
+    // can't grow the log-factorial table, which it does without
+    #pragma omp parallel for schedule( dynamic, 1 )
+    for ( int i = 0; i < nsample; ++i ) {
+        const sample_t & sample = args.samples[ i ];
+        FILE * const model = sample.model.empty() ? NULL : fopen( sample.model.c_str(), "r" );
+
+        if ( model ) {
+            const bool loaded = params_json_load( model, "variants", lg_Ls[ i ], aiccs[ i ], params[ i ], bgs[ i ] ) && bgs[ i ];
+
+            fclose( model );
+
+            if ( !loaded ) {
+                cerr << "unable to read model from: " << sample.model << endl;
+                exit( 1 );
+            }
+        }
+        else {
+            bamfile_t bamin( sample.bamin.c_str() );
+            data_t data;
+
+            stream_columns( bamin, data );
+
+            fit_model(
+                data,
+                false,
+                sample.model.empty() ? NULL : sample.model.c_str(),
+                lg_Ls[ i ],
+                aiccs[ i ],
+                params[ i ],
+                bgs[ i ],
+                // by sample rather than by thread, so a batch comes out the
+                // same however its samples are scheduled
+                i + 1
+                );
+
+            max_covs[ i ] = data.max_cov;
+        }
+    }
+
+    // the log-factorial table can only be grown outside of a parallel region
+    for ( int i = 0; i < nsample; ++i )
+        if ( max_covs[ i ] > max_cov )
+            max_cov = max_covs[ i ];
+
+    pileup.stop();
+
+    lg_factorial_reserve( max_cov );
+
+    // second pass: call variants
+    stats::scope_t call( stats::CALL );
+
+    #pragma omp parallel for schedule( dynamic, 1 )
+    for ( int i = 0; i < nsample; ++i ) {
+        const sample_t & sample = args.samples[ i ];
+        FILE * const out = fopen( sample.output.c_str(), "w" );
+
+        if ( !out ) {
+            cerr << "unable to write variants to: " << sample.output << endl;
+            exit( 1 );
+        }
+
+        bamfile_t bamin( sample.bamin.c_str() );
+        caller_t caller( bgs[ i ], args.cutoff, out );
+
+        stream_columns( bamin, caller );
+
+        fclose( out );
+    }
+
+    return 0;
+}
+
+
+// call variants on every sample of the manifest jointly: the BAMs are streamed
+// together, the background model is fitted to the data of all of them,
+// and every sample is called against it in the same pass
+int run_joint( const args_t & args )
+{
+    vector< bamfile_t * > bams;
+    vector< caller_t * > callers;
+    vector< FILE * > outs;
+    data_t data;
+    double lg_L, aicc, bg;
+    vector< pair< double, double > > params;
+    FILE * const model = args.model ? fopen( args.model, "r" ) : NULL;
+    const bool fit = !model || args.update;
+
+    for ( unsigned i = 0; i < args.samples.size(); ++i )
+        bams.push_back( new bamfile_t( args.samples[ i ].bamin.c_str() ) );
+
+    if ( model ) {
+        if ( !params_json_load( model, "variants", lg_L, aicc, params, bg ) || !bg ) {
+            cerr << "unable to read model from: " << args.model << endl;
+            exit( 1 );
+        }
+
+        fclose( model );
+    }
+
+    if ( fit ) {
+        vector< data_t * > pooled( bams.size(), &data );
+        stats::scope_t pileup( stats::PILEUP );
+
+        stream_cohort( bams, pooled );
+
+        pileup.stop();
+
+        fit_model( data, model != NULL, args.model, lg_L, aicc, params, bg );
+
+        for ( unsigned i = 0; i < bams.size(); ++i )
+            if ( !bams[ i ]->seek0() ) {
+                cerr << "unable to seek( 0 )" << endl;
+                exit( 1 );
+            }
+    }
+
+    params_json_dump( stderr, lg_L, aicc, params, bg );
+
+    lg_factorial_reserve( data.max_cov );
+
+    for ( unsigned i = 0; i < args.samples.size(); ++i ) {
+        FILE * const out = fopen( args.samples[ i ].output.c_str(), "w" );
+
+        if ( !out ) {
+            cerr << "unable to write variants to: " << args.samples[ i ].output << endl;
+            exit( 1 );
+        }
+
+        outs.push_back( out );
+        callers.push_back( new caller_t( bg, args.cutoff, out ) );
+    }
+
+    {
+        stats::scope_t call( stats::CALL );
+
+        stream_cohort( bams, callers );
+    }
+
+    for ( unsigned i = 0; i < bams.size(); ++i ) {
+        delete callers[ i ];
+        fclose( outs[ i ] );
+        delete bams[ i ];
+    }
+
+    return 0;
+}
+
+
+int main( int argc, const char * argv[] )
+{
+    args_t args = args_t( argc, argv );
+
+    stats::dump_at_exit( args.stats_json, EXEC );
+    stats::set_budget( args.memory_budget );
+
+    if ( !args.samples.empty() )
+        return args.joint ? run_joint( args ) : run_batch( args );
+
+    coverage_t coverage;
+    data_t data;
+    double lg_L, aicc, bg;
+    vector< pair< double, double > > params;
+    // region-restricted input comes from the index, so it's sorted and cheap to re-read
+    bool stream = args.bamin && ( args.stream || !args.bamin->get_regions().empty() );
+    FILE * const model = args.model ? fopen( args.model, "r" ) : NULL;
+    // with -u, a previous model is only the starting point of a new fit
+    const bool fit = !model || args.update;
+    // a lone pileup can be used in place, without building a coverage_t
+    pileup_t * const mapped = ( !args.bamin && args.pileups.size() == 1 && !args.pileup_out ) ?
+        new pileup_t( args.pileups[ 0 ] ) :
+        NULL;
+
+    // reuse a previously fitted model, if we have one
+    if ( model ) {
+        if ( !params_json_load( model, "variants", lg_L, aicc, params, bg ) || !bg ) {
+            cerr << "unable to read model from: " << args.model << endl;
+            exit( 1 );
+        }
+
+        fclose( model );
+    }
+
+    stats::scope_t pileup( stats::PILEUP );
+
+    if ( stream ) {
+        if ( fit )
+            stream_columns( *args.bamin, data );
+    }
+    else if ( mapped ) {
+        if ( fit )
+            for_each_column( *mapped, data );
+    }
+    else {
+        coverage_t::const_iterator cit;
+
+        if ( args.bamin ) {
+            bam1_t * const in_bam = bam_init1();
+            aligned_t read;
+
+            while ( !stats::over_budget() && args.bamin->next( in_bam ) ) {
+                read.from_bam( in_bam );
+                coverage.include( read );
+            }
+
+            bam_destroy1( in_bam );
+        }
+
+        // rather than wait on the kernel to kill us, stream BAM_IN after all;
+        // there's no streaming pileups into one another, though
+        if ( args.bamin && stats::over_budget() ) {
+            list< cov_t > dropped;
+
+            if ( !args.pileups.empty() || args.pileup_out ) {
+                cerr << "memory budget of " << stats::get_budget() << " bytes exceeded" << endl;
+                exit( 1 );
+            }
+
+            cerr << "memory budget of " << stats::get_budget() << " bytes exceeded, streaming BAM_IN instead" << endl;
+
+            // release() has untracked the pileup already, so really let it go,
+            // rather than hold it through the streaming pass
+            coverage.release( INT_MAX, dropped );
+            dropped.clear();
+
+            if ( !args.bamin->seek0() ) {
+                cerr << "unable to seek( 0 )" << endl;
+                exit( 1 );
+            }
+
+            stream = true;
+
+            if ( fit )
+                stream_columns( *args.bamin, data );
+        }
+
+        for ( unsigned i = 0; i < args.pileups.size(); ++i ) {
+            const pileup_t pileup( args.pileups[ i ] );
+            coverage.merge( pileup );
+        }
+
+        if ( args.pileup_out && !coverage.save( args.pileup_out ) ) {
+            cerr << "unable to write pileup to: " << args.pileup_out << endl;
+            exit( 1 );
+        }
+
+        for ( cit = coverage.begin(); cit != coverage.end(); ++cit )
+            data( *cit );
+    }
+
+    pileup.stop();
+
+    if ( fit )
+        fit_model( data, model != NULL, args.model, lg_L, aicc, params, bg );
+
+    params_json_dump( stderr, lg_L, aicc, params, bg );
+
+    lg_factorial_reserve( data.max_cov );
+
+    stats::scope_t call( stats::CALL );
+    caller_t caller( bg, args.cutoff );
+
+    if ( stream ) {
+        if ( fit && !args.bamin->seek0() ) {
+            cerr << "unable to seek( 0 )" << endl;
+            exit( 1 );
+        }
+
+        stream_columns( *args.bamin, caller );
+    }
+    else if ( mapped )
+        for_each_column( *mapped, caller );
+    else
+        for_each_column( coverage, caller );
+
+    delete mapped;
 
     return 0;
 }